@@ -0,0 +1,33 @@
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace bench {
+
+/* a benchmark. `run' does a fixed amount of work and returns how
+   much, in `unit's (tokens, calls, objects..), so that results can
+   be given as a rate. anything expensive to set up should be done
+   outside of `run', which is called many times */
+struct Bench
+{
+    std::string name;
+    std::string unit;
+    std::function<size_t ()> run;
+};
+
+std::vector<Bench>& registry ();
+
+// for registering benchmarks from static initializers:
+//   static bench::Register r("lex", "tokens", [] { ... });
+struct Register
+{
+    Register (std::string name, std::string unit, std::function<size_t ()> run);
+};
+
+// for measurements that aren't rates, such as memory used: called
+// from a benchmark's `run', and shown with its results. the last
+// value given under each name is the one shown
+void report (const std::string& name, double value);
+
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include "../src/bytecode/Program.h"
+
+namespace run {
+struct Environment;
+}
+
+namespace bench {
+
+/* counts r0 from 0 to n, running `body' each time around; the body
+   may use registers from r3 up. calls are bound to the functions
+   of `state' */
+bytecode::Program counted_loop (run::State& state, std::string name, Fixnum n,
+                                std::vector<bytecode::Instruction> body);
+
+/* fib(n) = n < 2 ? n : fib(n - 1) + fib(n - 2), calling itself
+   through `fib' and arithmetic through the functions of `env' */
+std::vector<bytecode::Instruction> fib_code (run::Environment& env, run::Function* fib);
+
+}
@@ -0,0 +1,105 @@
+#include "Bench.h"
+#include "../src/runtime/State.h"
+
+/* allocation through GC::make_*. the loops reach a safepoint after
+   every object, as bytecode would, so that collections happen */
+
+namespace {
+
+enum { Objects = 200000, Retained = 4096 };
+
+run::State& state ()
+{
+    static run::State st;
+    return st;
+}
+
+template <typename MakeFn>
+size_t alloc_loop (MakeFn make)
+{
+    auto& st = state();
+    for (size_t i = 0; i < Objects; i++) {
+        make(st, i);
+        if (st.gc.wants_collect())
+            st.gc.safepoint(&st);
+    }
+    return Objects;
+}
+
+bench::Register array_bench("alloc/array", "objects", [] {
+    return alloc_loop([] (run::State& st, size_t) { st.gc.make_array(4); });
+});
+
+bench::Register string_bench("alloc/string", "objects", [] {
+    return alloc_loop([] (run::State& st, size_t) {
+        st.gc.make_string("a string too long to be immediate");
+    });
+});
+
+bench::Register float_bench("alloc/float", "objects", [] {
+    // too small a magnitude to be stored immediately
+    return alloc_loop([] (run::State& st, size_t i) {
+        st.gc.make_float(1e-300 * double(i + 1));
+    });
+});
+
+bench::Register instance_bench("alloc/instance", "objects", [] {
+    auto& st = state();
+    static run::Cell point;
+    if (point.is_null()) {
+        boost::string_ref fields[] = { "x", "y" };
+        point = st.gc.make_datatype(run::Cell::DatatypeFields(fields, fields + 2));
+    }
+    auto before = st.gc.stats().allocated.bytes;
+    auto n = alloc_loop([] (run::State& st, size_t i) {
+        run::Cell args[] = { run::Cell::from_fixnum(Fixnum(i)), run::Cell::nil() };
+        st.gc.make_instance(point, args);
+    });
+
+    bench::report("bytes_per_instance", double(st.gc.stats().allocated.bytes - before) / n);
+    return n;
+});
+
+// one object in 16 survives for a while, in a ring of Retained
+bench::Register survivors_bench("alloc/survivors", "objects", [] {
+    auto& st = state();
+    auto ring = st.env.intern("bench-ring");
+    if (st.env.global(ring).is_null())
+        st.env.global(ring) = st.gc.make_array(Retained);
+    return alloc_loop([ring] (run::State& st, size_t i) {
+        auto obj = st.gc.make_array(4);
+        if (i % 16 == 0) {
+            st.gc.write_barrier(obj);
+            st.env.global(ring).children()[(i / 16) % Retained] = obj;
+        }
+    });
+});
+
+/* a 1 MB string built a character at a time. appends reuse the
+   buffer of the string being built, so each character costs a new
+   slice and a share of the buffer's doublings, rather than a copy of
+   everything so far */
+enum { ConcatBytes = 1 << 20 };
+
+bench::Register concat_bench("alloc/concat", "chars", [] {
+    auto& st = state();
+    auto built = st.env.intern("bench-concat");
+    auto ch = st.gc.make_string("x");
+    auto before = st.gc.stats().allocated.bytes;
+
+    st.env.global(built) = st.gc.make_string("");
+    for (size_t i = 0; i < ConcatBytes; i++) {
+        st.env.global(built) = st.gc.concat(st.env.global(built), ch);
+        if (st.gc.wants_collect())
+            st.gc.safepoint(&st);
+    }
+    if (st.env.global(built).string().size() != ConcatBytes)
+        throw std::runtime_error("string built wrongly");
+
+    bench::report("bytes_per_char",
+                  double(st.gc.stats().allocated.bytes - before) / ConcatBytes);
+    st.env.global(built) = run::Cell::nil();
+    return size_t(ConcatBytes);
+});
+
+}
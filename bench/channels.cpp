@@ -0,0 +1,113 @@
+#include "Bench.h"
+#include "../src/runtime/Channel.h"
+#include "../src/runtime/Collections.h"
+#include "../src/runtime/GC.h"
+#include "../src/runtime/State.h"
+#include <chrono>
+#include <functional>
+#include <thread>
+
+/* a pipeline of three isolates, one thread each: a producer makes
+   values, a relay passes them on, and a consumer looks at them. with
+   small messages this measures the channels themselves; with large
+   packed arrays, how much transferring saves over copying */
+
+namespace {
+
+enum { SmallMessages = 20000, LargeMessages = 2000, LargeBytes = 64 << 10 };
+
+// collections only happen at safepoints, which native loops have to
+// provide for themselves
+void safepoint (run::State& st)
+{
+    if (st.gc.wants_collect())
+        st.gc.safepoint(&st);
+}
+
+/* sends `n' values from make() down the pipeline. measure() gives
+   the bytes of data in each value as it arrives */
+size_t pipeline (size_t n, bool transfer, std::function<run::Cell (run::State&)> make,
+                 std::function<size_t (run::Cell)> measure)
+{
+    run::Channel first(16), second(16);
+    size_t bytes = 0, received = 0;
+    auto start = std::chrono::steady_clock::now();
+
+    std::thread producer([&] {
+        run::State st;
+        for (size_t i = 0; i < n; i++) {
+            first.send(make(st), transfer);
+            safepoint(st);
+        }
+        first.close();
+    });
+    std::thread relay([&] {
+        run::State st;
+        run::Cell x;
+        while (first.receive(st, x)) {
+            second.send(x, transfer);
+            safepoint(st);
+        }
+        second.close();
+    });
+
+    {
+        run::State st;
+        run::Cell x;
+        while (second.receive(st, x)) {
+            bytes += measure(x);
+            received++;
+            safepoint(st);
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    producer.join();
+    relay.join();
+
+    if (received != n)
+        throw std::runtime_error("pipeline lost messages");
+    bench::report("bytes_per_second", bytes / secs);
+    return n;
+}
+
+/* a vector of a few integers and a string */
+run::Cell make_small (run::State& st)
+{
+    run::Cell vec = st.gc.make_vector(8), str;
+    run::Frame frame(&st, &vec, 1, &str);
+    str = st.gc.make_string("the quick brown fox jumps");
+    run::vector_push(st.gc, vec, str);
+    for (int i = 0; i < 7; i++)
+        run::vector_push(st.gc, vec, run::Cell::from_fixnum(i));
+    return vec;
+}
+
+size_t small_bytes (run::Cell vec)
+{
+    return run::vector_length(vec) * sizeof(run::Cell)
+        + run::vector_at(vec, 0).string().size();
+}
+
+run::Cell make_large (run::State& st)
+{
+    return st.gc.make_packed(run::Object::Bytes, LargeBytes);
+}
+
+size_t large_bytes (run::Cell bytes)
+{
+    return bytes.packed_length();
+}
+
+bench::Register small_bench("channels/small", "messages", [] {
+    return pipeline(SmallMessages, false, make_small, small_bytes);
+});
+
+bench::Register copy_bench("channels/large-copy", "messages", [] {
+    return pipeline(LargeMessages, false, make_large, large_bytes);
+});
+
+bench::Register transfer_bench("channels/large-transfer", "messages", [] {
+    return pipeline(LargeMessages, true, make_large, large_bytes);
+});
+
+}
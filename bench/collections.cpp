@@ -0,0 +1,73 @@
+#include "Bench.h"
+#include "../src/runtime/Collections.h"
+#include "../src/runtime/State.h"
+
+/* a million elements pushed onto a vector, and a million entries set
+   in a table and looked up again, both starting out empty so that
+   growing is part of the cost */
+
+namespace {
+
+enum { Elements = 1000000 };
+
+run::State& state ()
+{
+    static run::State st;
+    return st;
+}
+
+// kept in a global while it's filled, and dropped afterwards
+run::Cell& slot ()
+{
+    static run::Symbol sym = state().env.intern("bench-collection");
+    return state().env.global(sym);
+}
+
+void drop ()
+{
+    slot() = run::Cell::nil();
+    if (state().gc.wants_collect())
+        state().gc.safepoint(&state());
+}
+
+bench::Register push_bench("collections/vector-push", "elements", [] {
+    auto& st = state();
+    slot() = st.gc.make_vector();
+    for (size_t i = 0; i < Elements; i++)
+        run::vector_push(st.gc, slot(), run::Cell::from_fixnum(Fixnum(i)));
+    drop();
+    return size_t(Elements);
+});
+
+bench::Register table_set_bench("collections/table-set", "entries", [] {
+    auto& st = state();
+    slot() = st.gc.make_table();
+    for (size_t i = 0; i < Elements; i++) {
+        auto key = run::Cell::from_fixnum(Fixnum(i));
+        run::table_set(st.gc, slot(), key, key);
+    }
+    drop();
+    return size_t(Elements);
+});
+
+bench::Register table_get_bench("collections/table-get", "lookups", [] {
+    auto& st = state();
+    static run::Symbol table = st.env.intern("bench-lookup-table");
+    if (st.env.global(table).is_null()) {
+        st.env.global(table) = st.gc.make_table();
+        for (size_t i = 0; i < Elements; i++) {
+            auto key = run::Cell::from_fixnum(Fixnum(i));
+            run::table_set(st.gc, st.env.global(table), key, key);
+        }
+    }
+
+    size_t found = 0;
+    run::Cell value;
+    for (size_t i = 0; i < Elements; i++)
+        found += run::table_get(st.env.global(table), run::Cell::from_fixnum(Fixnum(i)), value);
+    if (found != Elements)
+        throw std::runtime_error("lookups missed");
+    return size_t(Elements);
+});
+
+}
@@ -0,0 +1,127 @@
+#include "Bench.h"
+#include "../src/runtime/State.h"
+#include <memory>
+
+/* the scheduler of run::State: how fast coroutines switch, how fast
+   they're made, and how much memory one takes up while suspended */
+
+namespace {
+
+using bytecode::Instruction;
+using bytecode::Program;
+typedef Instruction I;
+
+enum { Switchers = 100, Yields = 1000, Spawns = 10000, Parked = 100000 };
+
+run::State& state ()
+{
+    static run::State st;
+    return st;
+}
+
+run::Function* function (const char* name)
+{
+    return state().env.get_function(name, true);
+}
+
+// a bytecode function `name' running `p'
+run::Function* define (const char* name, Program& p, std::vector<Instruction> ins)
+{
+    p.name = name;
+    p.instructions = std::move(ins);
+    state().env.impl_function(name, run::FunctionImpl(&p));
+    return function(name);
+}
+
+/* yielder(n): counts n down to zero, yielding each time around */
+Program yielder_program(1);
+
+bench::Register switch_bench("coroutines/switch", "switches", [] {
+    static run::Function* yielder = nullptr;
+    if (!yielder) {
+        yielder_program.reg_count = 3;
+        yielder = define("bench-yielder", yielder_program, {
+            I::fxn(0), I::store(1), I::load(0), I::store(2),
+            I::call(function("<"), 1, 2), I::branch(14),
+            I::call(function("yield"), 1, 0),
+            I::load(0), I::store(1), I::fxn(1), I::store(2),
+            I::call(function("-"), 1, 2), I::store(0), I::jump(0),
+            I::ret() });
+    }
+
+    run::Cell n = run::Cell::from_fixnum(Yields);
+    for (int i = 0; i < Switchers; i++)
+        state().spawn(yielder, &n, 1);
+    state().run_coroutines();
+    return size_t(Switchers * Yields);
+});
+
+/* identity(x), each in a coroutine of its own, run to completion */
+Program identity_program(1);
+
+bench::Register spawn_bench("coroutines/spawn", "coroutines", [] {
+    static run::Function* identity = nullptr;
+    if (!identity)
+        identity = define("bench-co-identity", identity_program, { I::load(0), I::ret() });
+
+    for (int i = 0; i < Spawns; i++) {
+        run::Cell x = run::Cell::from_fixnum(i);
+        state().spawn(identity, &x, 1);
+    }
+    state().run_coroutines();
+    return size_t(Spawns);
+});
+
+/* parked(x) = park(x) + x, called from waiter(x) so that each is two
+   activations deep when suspended */
+Program parked_program(1), waiter_program(1);
+std::vector<std::shared_ptr<run::Coroutine>> parked;
+
+run::Cell park_native (run::State* st, run::Cell* args)
+{
+    (void) args;
+    parked.push_back(st->suspend());
+    return run::Cell::nil();
+}
+
+size_t bytes_held (const run::Coroutine& co)
+{
+    return sizeof(co)
+        + co.regs.capacity() * sizeof(run::Cell)
+        + co.frames.capacity() * sizeof(run::Activation);
+}
+
+bench::Register park_bench("coroutines/park", "coroutines", [] {
+    static run::Function* waiter = nullptr;
+    if (!waiter) {
+        state().env.impl_function("bench-park", run::FunctionImpl(1, park_native));
+        parked_program.reg_count = 3;
+        auto parked_fn = define("bench-parked", parked_program, {
+            I::call(function("bench-park"), 0, 1), I::store(1), I::load(0), I::store(2),
+            I::call(function("+"), 1, 2), I::ret() });
+        waiter = define("bench-waiter", waiter_program, { I::call(parked_fn, 0, 1), I::ret() });
+    }
+
+    std::vector<std::shared_ptr<run::Coroutine>> cos;
+    cos.reserve(Parked);
+    parked.reserve(Parked);
+    for (int i = 0; i < Parked; i++) {
+        run::Cell x = run::Cell::from_fixnum(i);
+        cos.push_back(state().spawn(waiter, &x, 1));
+    }
+    state().run_coroutines();
+
+    // not counting what the allocator adds to each block
+    size_t bytes = 0;
+    for (auto& co : cos)
+        bytes += bytes_held(*co);
+    bench::report("bytes_per_coroutine", double(bytes) / Parked);
+
+    for (auto& co : parked)
+        state().wake(std::move(co), run::Cell::from_fixnum(1));
+    parked.clear();
+    state().run_coroutines();
+    return size_t(Parked);
+});
+
+}
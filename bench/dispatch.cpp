@@ -0,0 +1,91 @@
+#include "Bench.h"
+#include "../src/runtime/State.h"
+
+/* selecting an implementation for two arguments, in a function with
+   one implementation for each pair of Types datatypes, against one
+   with a single implementation for a single pair. dispatch looks up
+   each argument's datatype once, a level of its tree per argument,
+   so both should cost about the same however many implementations
+   there are */
+
+namespace {
+
+enum { Types = 8, Calls = 1000000 };
+
+run::State& state ()
+{
+    static run::State st;
+    return st;
+}
+
+run::Cell nothing (run::State* st, run::Cell* args)
+{
+    (void) st;
+    (void) args;
+    return run::Cell::nil();
+}
+
+struct Setup
+{
+    Setup ()
+    {
+        auto& st = state();
+        many = st.env.get_function("bench-overloaded", true);
+        one = st.env.get_function("bench-single", true);
+
+        boost::string_ref fields[] = { "x" };
+        std::vector<run::Cell> types;
+        for (int i = 0; i < Types; i++)
+            types.push_back(st.gc.make_datatype(run::Cell::DatatypeFields(fields, fields + 1)));
+        for (auto a : types)
+            for (auto b : types)
+                many->add_impl(run::FunctionImpl({ a, b }, nothing));
+        one->add_impl(run::FunctionImpl({ types[0], types[0] }, nothing));
+
+        // kept in a global, so that they aren't collected
+        instances = st.env.intern("bench-dispatch-instances");
+        auto insts = st.gc.make_array(Types);
+        st.env.global(instances) = insts;
+        for (int i = 0; i < Types; i++) {
+            run::Cell x = run::Cell::from_fixnum(i);
+            insts.children()[i] = st.gc.make_instance(types[i], &x);
+        }
+    }
+
+    run::Function* many;
+    run::Function* one;
+    run::Symbol instances;
+};
+
+Setup& setup ()
+{
+    static Setup s;
+    return s;
+}
+
+// with every pair of the instances, or only the first, `kinds' being
+// Types or 1
+size_t call_loop (run::Function* fn, size_t kinds)
+{
+    auto& st = state();
+    auto insts = st.env.global(setup().instances).children();
+    for (size_t i = 0; i < Calls; i++) {
+        run::Cell args[] = { insts[i % kinds], insts[(i / kinds) % kinds] };
+        auto impl = fn->dispatch(args, 2);
+        if (impl == nullptr)
+            throw std::runtime_error("no implementation found");
+        impl->call(&st, args);
+    }
+    return size_t(Calls);
+}
+
+bench::Register overloaded_bench("dispatch/64-overloads", "calls", [] {
+    bench::report("implementations", setup().many->implementations.size());
+    return call_loop(setup().many, Types);
+});
+
+bench::Register single_bench("dispatch/1-overload", "calls", [] {
+    return call_loop(setup().one, 1);
+});
+
+}
@@ -0,0 +1,27 @@
+#include "Bench.h"
+#include "../src/runtime/Executor.h"
+#include "../src/runtime/State.h"
+#include <memory>
+
+/* round trips through an Executor: small calls submitted from this
+   thread and run on a pool of isolates, one per core */
+
+namespace {
+
+enum { Jobs = 20000 };
+
+bench::Register executor_bench("executor/calls", "jobs", [] {
+    static std::unique_ptr<run::Executor> ex;
+    if (!ex)
+        ex.reset(new run::Executor);
+
+    std::vector<std::future<run::Value>> results;
+    results.reserve(Jobs);
+    for (int i = 0; i < Jobs; i++)
+        results.push_back(ex->submit("+", { i, 1 }));
+    for (auto& r : results)
+        r.get();
+    return size_t(Jobs);
+});
+
+}
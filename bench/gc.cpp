@@ -0,0 +1,330 @@
+#include "Bench.h"
+#include "../src/runtime/State.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* the collector on heaps larger than the other benchmarks build */
+
+namespace {
+
+/*** marking on several threads ***/
+
+/* a whole collection of a heap of BigObjects small arrays, with 1, 2,
+   4, .. mark threads up to the number of cores. each run is one
+   pause. the heap is a tree Fanout wide, so that there's plenty for
+   the markers to split between them */
+enum { BigObjects = 10000000, Fanout = 1000 };
+
+struct BigHeap
+{
+    BigHeap ()
+    {
+        auto root = st.env.intern("bench-big-heap");
+        st.env.global(root) = st.gc.make_array(BigObjects / Fanout);
+        for (size_t b = 0; b < BigObjects / Fanout; b++) {
+            auto branch = st.gc.make_array(Fanout);
+            st.env.global(root).children()[b] = branch;
+            for (auto& leaf : branch.children())
+                leaf = st.gc.make_array(1);
+        }
+    }
+
+    run::State st;
+};
+
+BigHeap& big_heap ()
+{
+    static std::unique_ptr<BigHeap> heap(new BigHeap);
+    return *heap;
+}
+
+struct RegisterMarkScaling
+{
+    RegisterMarkScaling ()
+    {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned n = 1; ; n = std::min(n * 2, cores)) {
+            bench::Register("gc/mark-" + std::to_string(n), "objects", [n] {
+                auto& st = big_heap().st;
+                st.gc.set_mark_threads(n);
+                st.gc.collect(&st);
+                auto& last = st.gc.stats().history.back();
+                bench::report("pause_ms", last.max_pause_ms);
+                bench::report("mark_ms", last.mark_ms);
+                return last.live.objects;
+            });
+            if (n == cores)
+                break;
+        }
+    }
+} register_mark_scaling;
+
+
+
+/*** incremental collection ***/
+
+/* steady allocation in incremental mode, with one object in four kept
+   for a while in a ring of Survivors, so that every collection has
+   marking to spread over its slices. reports the pauses, slices and
+   whole collections alike, recorded by this and earlier runs */
+enum { SteadyObjects = 1000000, Survivors = 200000 };
+
+run::State& incremental_state ()
+{
+    static run::State st;
+    static bool ready = false;
+    if (!ready) {
+        st.gc.set_incremental(true);
+        st.env.global(st.env.intern("bench-survivors")) = st.gc.make_array(Survivors);
+        ready = true;
+    }
+    return st;
+}
+
+double percentile (const std::vector<double>& sorted, double p)
+{
+    return sorted[size_t(p * (sorted.size() - 1))];
+}
+
+bench::Register incremental_bench("gc/incremental", "objects", [] {
+    auto& st = incremental_state();
+    auto ring = st.env.intern("bench-survivors");
+    for (size_t i = 0; i < SteadyObjects; i++) {
+        auto obj = st.gc.make_array(4);
+        if (i % 4 == 0) {
+            st.gc.write_barrier(obj);
+            st.env.global(ring).children()[(i / 4) % Survivors] = obj;
+        }
+        if (st.gc.wants_collect())
+            st.gc.safepoint(&st);
+    }
+
+    auto& pauses = st.gc.stats().pauses;
+    if (!pauses.empty()) {
+        std::vector<double> sorted(pauses.begin(), pauses.end());
+        std::sort(sorted.begin(), sorted.end());
+        bench::report("p50_pause_ms", percentile(sorted, 0.5));
+        bench::report("p99_pause_ms", percentile(sorted, 0.99));
+        bench::report("max_pause_ms", sorted.back());
+    }
+    return size_t(SteadyObjects);
+});
+
+
+
+/*** memory ***/
+
+// of this process, in bytes
+size_t rss_bytes ()
+{
+    std::ifstream statm("/proc/self/statm");
+    size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * size_t(sysconf(_SC_PAGESIZE));
+}
+
+// of this process, in bytes: the pages it has written since it was
+// forked, rather than still sharing with its parent
+size_t private_dirty_bytes ()
+{
+    std::ifstream rollup("/proc/self/smaps_rollup");
+    std::string field;
+    size_t kb = 0;
+    while (rollup >> field) {
+        if (field == "Private_Dirty:") {
+            rollup >> kb;
+            break;
+        }
+    }
+    return kb * 1024;
+}
+
+/* runs `fn' in a forked child, so that what it does to the memory of
+   the process is measured apart from (and doesn't carry over to) the
+   other benchmarks, and returns the `count' numbers it gives back */
+std::vector<double> in_child (size_t count, const std::function<std::vector<double> ()>& fn)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+        throw std::runtime_error("pipe failed");
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("fork failed");
+
+    if (pid == 0) {
+        close(fds[0]);
+        std::vector<double> out;
+        try {
+            out = fn();
+        }
+        catch (...) {
+        }
+        out.resize(count);
+        ssize_t written = write(fds[1], out.data(), count * sizeof(double));
+        _exit(written == ssize_t(count * sizeof(double)) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    std::vector<double> out(count);
+    auto bytes = read(fds[0], out.data(), count * sizeof(double));
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (bytes != ssize_t(count * sizeof(double)) || !WIFEXITED(status)
+        || WEXITSTATUS(status) != 0)
+        throw std::runtime_error("benchmark child failed");
+    return out;
+}
+
+
+/*** fragmentation ***/
+
+/* arrays of mixed sizes, from 16 bytes to a few KB with the odd one
+   of 16 KB, each replacing a random one of ChurnLive kept in a ring,
+   with and without compaction. reports how much the process grew by,
+   after a final collection, against the bytes still live */
+enum { ChurnObjects = 1000000, ChurnLive = 50000 };
+
+std::vector<double> churn (bool compacting)
+{
+    size_t before = rss_bytes();
+    run::State st;
+    st.gc.set_compacting(compacting);
+    auto ring = st.env.intern("bench-churn");
+    st.env.global(ring) = st.gc.make_array(ChurnLive);
+
+    uint64_t x = 88172645463325252ull;
+    for (size_t i = 0; i < ChurnObjects; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        size_t cells = (x % 64 == 0) ? 2048 : 1 + (x >> 8) % 64;
+        auto obj = st.gc.make_array(cells);
+        st.gc.write_barrier(obj);
+        st.env.global(ring).children()[(x >> 16) % ChurnLive] = obj;
+        if (st.gc.wants_collect())
+            st.gc.safepoint(&st);
+    }
+    st.gc.collect(&st);
+
+    double mb = 1 << 20;
+    return { (rss_bytes() - before) / mb, st.gc.stats().history.back().live.bytes / mb };
+}
+
+size_t report_churn (bool compacting)
+{
+    auto out = in_child(2, [compacting] { return churn(compacting); });
+    bench::report("rss_growth_mb", out[0]);
+    bench::report("live_mb", out[1]);
+    return size_t(ChurnObjects);
+}
+
+bench::Register churn_bench("gc/churn", "objects", [] {
+    return report_churn(false);
+});
+
+bench::Register churn_compacting_bench("gc/churn-compacting", "objects", [] {
+    return report_churn(true);
+});
+
+
+
+/*** page sharing ***/
+
+/* a collection in a forked child of a heap built by the parent, of
+   SharedObjects small arrays. they're allocated from chunks and
+   marked in the chunks' bitmaps, so the heap's pages should stay
+   shared with the parent, with compaction on or off; only the
+   bitmaps and the collector's own tables become the child's */
+enum { SharedObjects = 1000000 };
+
+struct SharedHeap
+{
+    SharedHeap (bool compacting)
+    {
+        st.gc.set_compacting(compacting);
+        auto root = st.env.intern("bench-shared-heap");
+        st.env.global(root) = st.gc.make_array(SharedObjects / Fanout);
+        for (size_t b = 0; b < SharedObjects / Fanout; b++) {
+            auto branch = st.gc.make_array(Fanout);
+            st.env.global(root).children()[b] = branch;
+            for (auto& leaf : branch.children())
+                leaf = st.gc.make_array(1);
+        }
+        st.gc.collect(&st);
+    }
+
+    run::State st;
+};
+
+size_t report_sharing (bool compacting)
+{
+    static std::unique_ptr<SharedHeap> heaps[2];
+    auto& heap = heaps[compacting];
+    if (!heap)
+        heap.reset(new SharedHeap(compacting));
+
+    auto& st = heap->st;
+    auto out = in_child(2, [&st] {
+        size_t before = private_dirty_bytes();
+        st.gc.collect(&st);
+        double mb = 1 << 20;
+        return std::vector<double> {
+            (private_dirty_bytes() - before) / mb,
+            st.gc.stats().history.back().live.bytes / mb,
+        };
+    });
+    bench::report("dirtied_mb", out[0]);
+    bench::report("heap_mb", out[1]);
+    return size_t(SharedObjects);
+}
+
+bench::Register fork_bench("gc/fork", "objects", [] {
+    return report_sharing(false);
+});
+
+bench::Register fork_compacting_bench("gc/fork-compacting", "objects", [] {
+    return report_sharing(true);
+});
+
+
+
+/*** interned strings ***/
+
+/* strings interned, collected with compaction on (so marked in chunk
+   bitmaps rather than their headers) while a global keeps them, and
+   interned again. each must come back as the same object, or equal
+   strings would compare unequal */
+enum { InternedStrings = 100000 };
+
+bench::Register reintern_bench("gc/reintern", "strings", [] {
+    run::State st;
+    st.gc.set_compacting(true);
+    auto kept = st.env.intern("bench-interned");
+    st.env.global(kept) = st.gc.make_array(InternedStrings);
+
+    auto text = [] (size_t i) { return "an interned string " + std::to_string(i); };
+    for (size_t i = 0; i < InternedStrings; i++) {
+        auto str = st.intern(text(i));
+        st.gc.write_barrier(str);
+        st.env.global(kept).children()[i] = str;
+    }
+    st.gc.collect(&st);
+
+    for (size_t i = 0; i < InternedStrings; i++) {
+        auto again = st.intern(text(i));
+        auto first = st.env.global(kept).children()[i];
+        if (again.obj != first.obj || !again.string_equals(first))
+            throw std::runtime_error("interning again after a collection made a new string");
+    }
+    return size_t(InternedStrings);
+});
+
+}
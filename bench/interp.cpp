@@ -0,0 +1,274 @@
+#include "Bench.h"
+#include "Programs.h"
+#include "../src/runtime/State.h"
+
+/* Program::execute on hand-assembled programs, until there is a
+   compiler to produce them from source. programs mostly call each
+   other through native functions that execute them */
+
+namespace bench {
+
+using bytecode::Instruction;
+using bytecode::Program;
+typedef Instruction I;
+
+Program counted_loop (run::State& state, std::string name, Fixnum n,
+                      std::vector<Instruction> body)
+{
+    auto function = [&] (const char* fn) { return state.env.get_function(fn); };
+    Program p(0);
+    p.name = std::move(name);
+    p.reg_count = 5;
+    auto& ins = p.instructions;
+    ins = { I::fxn(0), I::store(0) };
+    int top = int(ins.size());
+    ins.insert(ins.end(), {
+        I::load(0), I::store(1), I::fxn(n), I::store(2),
+        I::call(function("<"), 1, 2), I::branch(0) });
+    size_t exit_branch = ins.size() - 1;
+    ins.insert(ins.end(), body.begin(), body.end());
+    ins.insert(ins.end(), {
+        I::load(0), I::store(1), I::fxn(1), I::store(2),
+        I::call(function("+"), 1, 2), I::store(0), I::jump(top) });
+    ins[exit_branch] = I::branch(int(ins.size()));
+    ins.push_back(I::ret());
+    return p;
+}
+
+std::vector<Instruction> fib_code (run::Environment& env, run::Function* fib)
+{
+    auto less = env.get_function("<"), plus = env.get_function("+"),
+        minus = env.get_function("-");
+    return {
+        I::load(0), I::store(1), I::fxn(2), I::store(2), I::call(less, 1, 2), I::branch(8),
+        I::load(0), I::ret(),
+        I::load(0), I::store(1), I::fxn(1), I::store(2), I::call(minus, 1, 2),
+        I::store(1), I::call(fib, 1, 1), I::store(3),
+        I::load(0), I::store(1), I::fxn(2), I::store(2), I::call(minus, 1, 2),
+        I::store(1), I::call(fib, 1, 1), I::store(2),
+        I::load(3), I::store(1), I::call(plus, 1, 2), I::ret(),
+    };
+}
+
+}
+
+namespace {
+
+using bench::counted_loop;
+using bench::fib_code;
+using bytecode::Instruction;
+using bytecode::Program;
+typedef Instruction I;
+
+run::State& state ()
+{
+    static run::State st;
+    return st;
+}
+
+run::Function* function (const char* name)
+{
+    return state().env.get_function(name, true);
+}
+
+Program fib_program(1);
+size_t fib_calls;
+
+run::Cell fib_native (run::State* st, run::Cell* args)
+{
+    fib_calls++;
+    return fib_program.execute(st, args);
+}
+
+bench::Register fib_bench("interp/fib", "calls", [] {
+    static bool ready = false;
+    if (!ready) {
+        state().env.impl_function("bench-fib", run::FunctionImpl(1, fib_native));
+        fib_program.name = "fib";
+        fib_program.reg_count = 4;
+        fib_program.instructions = fib_code(state().env, function("bench-fib"));
+        ready = true;
+    }
+
+    fib_calls = 0;
+    run::Cell n = run::Cell::from_fixnum(25);
+    fib_native(&state(), &n);
+    return fib_calls;
+});
+
+/* the same, but calling the program directly rather than through a
+   native function, so that calls don't recurse; see run::Coroutine */
+Program fib_direct_program(1);
+
+bench::Register fib_direct_bench("interp/fib-direct", "calls", [] {
+    static bool ready = false;
+    if (!ready) {
+        fib_direct_program.name = "fib";
+        fib_direct_program.reg_count = 4;
+        fib_direct_program.instructions = fib_code(state().env, function("bench-fib-direct"));
+        state().env.impl_function("bench-fib-direct", run::FunctionImpl(&fib_direct_program));
+        ready = true;
+    }
+
+    run::Cell n = run::Cell::from_fixnum(25);
+    fib_direct_program.execute(&state(), &n);
+    // fib(25) makes 2 fib(26) - 1 calls
+    return size_t(242785);
+});
+
+bench::Register loop_bench("interp/loop", "iterations", [] {
+    static auto p = counted_loop(state(), "loop", 1000000, {});
+    p.execute(&state(), nullptr);
+    return size_t(1000000);
+});
+
+/* a bytecode -> native -> bytecode call each time around */
+Program identity_program(1);
+
+run::Cell identity_native (run::State* st, run::Cell* args)
+{
+    return identity_program.execute(st, args);
+}
+
+bench::Register calls_bench("interp/calls", "calls", [] {
+    static bool ready = false;
+    if (!ready) {
+        state().env.impl_function("bench-identity", run::FunctionImpl(1, identity_native));
+        identity_program.name = "identity";
+        identity_program.instructions = { I::load(0), I::ret() };
+        ready = true;
+    }
+
+    static auto p = counted_loop(state(), "calls", 500000, {
+        I::load(0), I::store(3), I::call(function("bench-identity"), 3, 1) });
+    p.execute(&state(), nullptr);
+    return size_t(500000);
+});
+
+/* x = i * 0.5 + 1.25 each time around. floats in that range are
+   immediate, so the loop shouldn't allocate at all; the count of
+   objects allocated is reported */
+run::Cell immediate (double d)
+{
+    run::Cell x;
+    if (!run::Cell::immediate_float(d, x))
+        throw std::runtime_error("not an immediate float");
+    return x;
+}
+
+bench::Register float_loop_bench("interp/float-loop", "iterations", [] {
+    static Program p(0);
+    if (p.instructions.empty()) {
+        // the constants are added after assembling, as 0 and 1
+        p = counted_loop(state(), "float-loop", 1000000, {
+            I::load(0), I::store(1), I::constant(0), I::store(2),
+            I::call(function("*"), 1, 2), I::store(1), I::constant(1), I::store(2),
+            I::call(function("+"), 1, 2), I::store(3) });
+        p.add_constant(immediate(0.5));
+        p.add_constant(immediate(1.25));
+    }
+
+    auto before = state().gc.stats().allocated.objects;
+    p.execute(&state(), nullptr);
+    bench::report("objects_allocated", state().gc.stats().allocated.objects - before);
+    return size_t(1000000);
+});
+
+/* each time around, every one of Globals globals is read and stored
+   into the next, through symbols interned once when assembling */
+enum { Globals = 2000, GlobalRounds = 500 };
+
+bench::Register globals_bench("interp/globals", "accesses", [] {
+    static Program p(0);
+    if (p.instructions.empty()) {
+        std::vector<run::Symbol> syms;
+        for (int i = 0; i < Globals; i++) {
+            syms.push_back(state().env.intern("bench-global-" + std::to_string(i)));
+            state().env.global(syms.back()) = run::Cell::from_fixnum(i);
+        }
+        std::vector<Instruction> body;
+        for (int i = 0; i < Globals; i++) {
+            body.push_back(I::global_load(syms[i]));
+            body.push_back(I::global_store(syms[(i + 1) % Globals]));
+        }
+        p = counted_loop(state(), "globals", GlobalRounds, body);
+    }
+    p.execute(&state(), nullptr);
+    return size_t(2 * Globals * GlobalRounds);
+});
+
+/* a fresh vector each time around, with two elements pushed */
+bench::Register alloc_heavy_bench("interp/vectors", "iterations", [] {
+    static auto p = counted_loop(state(), "vectors", 300000, {
+        I::call(function("vector"), 3, 0), I::store(3),
+        I::load(0), I::store(4), I::call(function("push"), 3, 2),
+        I::call(function("push"), 3, 2) });
+    p.execute(&state(), nullptr);
+    return size_t(300000);
+});
+
+/* a script that keeps using the same two strings: each time around,
+   both literals are pushed onto a vector kept in a global, as a list
+   of names would be built. interned, as program constants are, every
+   element is one of two objects; copied, each evaluation makes a new
+   string, as literals did before interning (natives standing in for
+   that). reports the bytes allocated, and the bytes live once the
+   vector is full */
+enum { LiteralRounds = 200000 };
+const char* Literals[] = { "a name used over and over", "another name used as often" };
+
+run::Cell first_literal (run::State* st, run::Cell*)
+{
+    return st->gc.make_string(Literals[0]);
+}
+
+run::Cell second_literal (run::State* st, run::Cell*)
+{
+    return st->gc.make_string(Literals[1]);
+}
+
+size_t literals_loop (bool interned)
+{
+    run::State st;
+    st.env.impl_function("bench-first-literal", run::FunctionImpl(0, first_literal));
+    st.env.impl_function("bench-second-literal", run::FunctionImpl(0, second_literal));
+    auto names = st.env.intern("bench-names");
+    auto push = st.env.get_function("push");
+
+    std::vector<Instruction> body;
+    for (int k = 0; k < 2; k++) {
+        body.push_back(I::global_load(names));
+        body.push_back(I::store(3));
+        if (interned)
+            body.push_back(I::constant(k));
+        else
+            body.push_back(I::call(st.env.get_function(k == 0 ? "bench-first-literal"
+                                                              : "bench-second-literal"), 4, 0));
+        body.push_back(I::store(4));
+        body.push_back(I::call(push, 3, 2));
+    }
+    auto p = counted_loop(st, "literals", LiteralRounds, body);
+    for (auto text : Literals)
+        p.add_constant(st.intern_constant(text));
+
+    st.env.global(names) = st.gc.make_vector();
+    auto before = st.gc.stats().allocated.bytes;
+    p.execute(&st, nullptr);
+    auto allocated = st.gc.stats().allocated.bytes - before;
+    st.gc.collect(&st);
+
+    double mb = 1 << 20;
+    bench::report("allocated_mb", allocated / mb);
+    bench::report("live_mb", st.gc.stats().history.back().live.bytes / mb);
+    return size_t(2 * LiteralRounds);
+}
+
+bench::Register interned_literals_bench("interp/literals-interned", "strings", [] {
+    return literals_loop(true);
+});
+
+bench::Register copied_literals_bench("interp/literals-copied", "strings", [] {
+    return literals_loop(false);
+});
+
+}
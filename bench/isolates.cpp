@@ -0,0 +1,66 @@
+#include "Bench.h"
+#include "Programs.h"
+#include "../src/runtime/State.h"
+#include <memory>
+#include <thread>
+
+/* the same allocating loop in 1, 2, 4, .. States at once, one thread
+   each, up to the number of cores. with nothing shared, the rate
+   should grow with the number of isolates */
+
+namespace {
+
+using bytecode::Instruction;
+typedef Instruction I;
+
+enum { Iterations = 200000 };
+
+struct Isolate
+{
+    // with `mark_threads' each, so that n isolates mark on no more
+    // threads than there are cores
+    explicit Isolate (unsigned mark_threads)
+        : program(bench::counted_loop(state, "isolate", Iterations, {
+              I::call(state.env.get_function("vector"), 3, 0), I::store(3),
+              I::load(0), I::store(4), I::call(state.env.get_function("push"), 3, 2),
+              I::call(state.env.get_function("+"), 0, 2) }))
+    {
+        state.gc.set_mark_threads(mark_threads);
+    }
+
+    run::State state;
+    bytecode::Program program;
+};
+
+size_t run_isolates (std::vector<std::unique_ptr<Isolate>>& isolates)
+{
+    std::vector<std::thread> threads;
+    for (auto& iso : isolates) {
+        auto p = iso.get();
+        threads.emplace_back([p] { p->program.execute(&p->state, nullptr); });
+    }
+    for (auto& t : threads)
+        t.join();
+    return isolates.size() * Iterations;
+}
+
+struct RegisterScaling
+{
+    RegisterScaling ()
+    {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned n = 1; ; n = std::min(n * 2, cores)) {
+            auto isolates = std::make_shared<std::vector<std::unique_ptr<Isolate>>>();
+            bench::Register("isolates/" + std::to_string(n), "iterations", [isolates, n, cores] {
+                // made on first use, so that filtered out runs cost nothing
+                while (isolates->size() < n)
+                    isolates->emplace_back(new Isolate(cores / n));
+                return run_isolates(*isolates);
+            });
+            if (n == cores)
+                break;
+        }
+    }
+} register_scaling;
+
+}
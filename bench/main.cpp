@@ -0,0 +1,158 @@
+#include "Bench.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <boost/format.hpp>
+
+/* runs the benchmark suite:
+
+     ic-bench [-n RUNS] [-w WARMUPS] [-o FILE] [NAME...]
+
+   every benchmark whose name contains one of the NAMEs is run (all
+   of them, without NAMEs), first WARMUPS times untimed and then RUNS
+   times timed. a summary goes to stdout, and if FILE is given, one
+   JSON object per benchmark is written to it, for tracking
+   regressions between builds */
+
+namespace bench {
+
+std::vector<Bench>& registry ()
+{
+    static std::vector<Bench> benches;
+    return benches;
+}
+
+Register::Register (std::string name, std::string unit, std::function<size_t ()> run)
+{
+    registry().push_back(Bench { std::move(name), std::move(unit), std::move(run) });
+}
+
+// of the benchmark being run
+std::map<std::string, double> reported;
+
+void report (const std::string& name, double value)
+{
+    reported[name] = value;
+}
+
+}
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+struct Summary
+{
+    size_t units;
+    // seconds per run
+    double median, mean, stddev, min, max;
+};
+
+Summary measure (const bench::Bench& b, int warmups, int runs)
+{
+    for (int i = 0; i < warmups; i++)
+        b.run();
+
+    Summary s;
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        auto start = Clock::now();
+        s.units = b.run();
+        times.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    std::sort(times.begin(), times.end());
+    size_t n = times.size();
+    s.median = n % 2 ? times[n / 2] : (times[n / 2 - 1] + times[n / 2]) / 2;
+    s.min = times.front();
+    s.max = times.back();
+    s.mean = 0;
+    for (auto t : times)
+        s.mean += t;
+    s.mean /= n;
+    s.stddev = 0;
+    for (auto t : times)
+        s.stddev += (t - s.mean) * (t - s.mean);
+    s.stddev = n > 1 ? std::sqrt(s.stddev / (n - 1)) : 0;
+    return s;
+}
+
+int parse_count (const char* opt, const char* arg)
+{
+    int n = arg ? std::atoi(arg) : 0;
+    if (n < (std::strcmp(opt, "-w") == 0 ? 0 : 1)) {
+        auto fmt = boost::format("bad count for %s") % opt;
+        throw std::runtime_error(fmt.str());
+    }
+    return n;
+}
+
+}
+
+int main (int argc, char** argv)
+{
+    try {
+        int runs = 10, warmups = 2;
+        const char* json_path = nullptr;
+        std::vector<std::string> filters;
+        for (int i = 1; i < argc; i++) {
+            if (std::strcmp(argv[i], "-n") == 0)
+                runs = parse_count(argv[i], argv[i + 1]), i++;
+            else if (std::strcmp(argv[i], "-w") == 0)
+                warmups = parse_count(argv[i], argv[i + 1]), i++;
+            else if (std::strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+                json_path = argv[++i];
+            else
+                filters.push_back(argv[i]);
+        }
+
+        std::ofstream json;
+        if (json_path) {
+            json.open(json_path);
+            if (!json)
+                throw std::runtime_error(std::string("cannot write ") + json_path);
+        }
+
+        std::cout << boost::format("%-22s %12s %12s %8s %16s\n")
+            % "benchmark" % "units/run" % "median ms" % "+/- %" % "rate";
+        for (auto& b : bench::registry()) {
+            if (!filters.empty()
+                && std::none_of(filters.begin(), filters.end(),
+                                [&] (const std::string& f) {
+                                    return b.name.find(f) != std::string::npos;
+                                }))
+                continue;
+
+            bench::reported.clear();
+            auto s = measure(b, warmups, runs);
+            double rate = s.units / s.median;
+            std::cout << boost::format("%-22s %12d %12.3f %8.2f %12.4g %s/s\n")
+                % b.name % s.units % (s.median * 1000)
+                % (100 * s.stddev / s.mean) % rate % b.unit;
+            for (auto& r : bench::reported)
+                std::cout << boost::format("  %-20s %12.4g\n") % r.first % r.second;
+
+            if (json_path) {
+                json << boost::format("{\"name\": \"%s\", \"unit\": \"%s\", \"units\": %d, "
+                                      "\"runs\": %d, \"median_s\": %.9g, \"mean_s\": %.9g, "
+                                      "\"stddev_s\": %.9g, \"min_s\": %.9g, \"max_s\": %.9g, "
+                                      "\"rate\": %.9g")
+                    % b.name % b.unit % s.units % runs % s.median % s.mean
+                    % s.stddev % s.min % s.max % rate;
+                for (auto& r : bench::reported)
+                    json << boost::format(", \"%s\": %.9g") % r.first % r.second;
+                json << "}\n";
+            }
+        }
+    }
+    catch (std::runtime_error& err) {
+        std::cerr << "error:" << std::endl
+                  << err.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "Bench.h"
+#include "Programs.h"
+#include "../src/runtime/Image.h"
+#include "../src/runtime/Packed.h"
+#include "../src/runtime/Pool.h"
+#include <chrono>
+#include <memory>
+
+/* cpu-bound work on every element of an array, fib(n) for each n:
+   called one after another in a single State, then spread over the
+   image's pool (one worker per core) by parallel_map, and by
+   parallel_for over a packed array, with each piece's elements
+   replaced by their results. both report their speedup over the last
+   serial run. the -4 variants always have a pool of 4, so that the
+   pieces go through workers (and messages) even on a machine with
+   one core, where the others do them all in the calling State */
+
+namespace {
+
+// FibResult is fib(FibN)
+enum { Elements = 64, FibN = 18, FibResult = 2584 };
+
+typedef std::chrono::steady_clock Clock;
+
+// fib(x) in place of every x in a packed array, for parallel_for
+run::Cell fib_each (run::State* st, run::Cell* args)
+{
+    run::Cell x, result;
+    run::Frame frame(st, args, 1, &result);
+    auto fib = st->env.get_function("fib");
+    size_t n = args[0].packed_length();
+    for (size_t i = 0; i < n; i++) {
+        x = run::packed_get(st->gc, args[0], Fixnum(i));
+        result = fib->dispatch(&x, 1)->call(st, &x);
+        run::packed_set(args[0], Fixnum(i), result);
+    }
+    return run::Cell::nil();
+}
+
+struct Setup
+{
+    // `workers' for the pool, 0 for one per core
+    explicit Setup (unsigned workers)
+    {
+        image.pool_workers = workers;
+        auto fib = image.env.get_function("fib", true);
+        auto& prog = image.add_program("fib", 1);
+        prog.reg_count = 4;
+        prog.instructions = bench::fib_code(image.env, fib);
+        image.env.impl_function("fib", run::FunctionImpl(&prog));
+        image.env.impl_function("fib-each", run::FunctionImpl(1, fib_each));
+
+        state.reset(new run::State(image));
+        input = state->env.intern("bench-parallel-input");
+        auto xs = state->gc.make_array(Elements);
+        for (auto& x : xs.children())
+            x = run::Cell::from_fixnum(FibN);
+        state->env.global(input) = xs;
+        packed_input = state->env.intern("bench-parallel-packed");
+        state->env.global(packed_input) = state->gc.make_packed(run::Object::Int64s, Elements);
+    }
+
+    run::Image image;
+    std::unique_ptr<run::State> state;
+    // the globals holding the array, and a packed one for parallel_for
+    run::Symbol input, packed_input;
+};
+
+Setup& setup ()
+{
+    static Setup s(0);
+    return s;
+}
+
+Setup& setup4 ()
+{
+    static Setup s(4);
+    return s;
+}
+
+// seconds taken by the last serial run
+double serial_seconds = 0;
+
+bench::Register serial_bench("parallel/serial", "elements", [] {
+    auto& st = *setup().state;
+    auto start = Clock::now();
+    auto fib = st.env.get_function("fib");
+    for (size_t i = 0; i < Elements; i++) {
+        run::Cell x = st.env.global(setup().input).children()[i];
+        fib->dispatch(&x, 1)->call(&st, &x);
+    }
+    serial_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return size_t(Elements);
+});
+
+size_t map_on (Setup& setup)
+{
+    auto& st = *setup.state;
+    auto start = Clock::now();
+    run::Cell args[2] = { st.intern("fib"), st.env.global(setup.input) }, result;
+    run::Frame frame(&st, args, 2, &result);
+    result = st.env.get_function("parallel_map")->dispatch(args, 2)->call(&st, args);
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto results = result.children();
+    if (results.size() != Elements || results[Elements - 1].integer() != FibResult)
+        throw std::runtime_error("parallel_map gave the wrong results");
+
+    bench::report("workers", setup.image.pool().workers());
+    if (serial_seconds > 0)
+        bench::report("speedup", serial_seconds / secs);
+    return size_t(Elements);
+}
+
+bench::Register map_bench("parallel/map", "elements", [] {
+    return map_on(setup());
+});
+
+bench::Register map4_bench("parallel/map-4", "elements", [] {
+    return map_on(setup4());
+});
+
+size_t for_on (Setup& setup)
+{
+    auto& st = *setup.state;
+    // the last run left its results in place
+    run::packed_fill(st.env.global(setup.packed_input), run::Cell::from_fixnum(FibN));
+
+    auto start = Clock::now();
+    run::Cell args[2] = { st.intern("fib-each"), st.env.global(setup.packed_input) }, result;
+    run::Frame frame(&st, args, 2, &result);
+    st.env.get_function("parallel_for")->dispatch(args, 2)->call(&st, args);
+    double secs = std::chrono::duration<double>(Clock::now() - start).count();
+
+    if (run::packed_sum(st.gc, args[1]).integer() != Fixnum(Elements) * FibResult)
+        throw std::runtime_error("parallel_for gave the wrong results");
+
+    bench::report("workers", setup.image.pool().workers());
+    if (serial_seconds > 0)
+        bench::report("speedup", serial_seconds / secs);
+    return size_t(Elements);
+}
+
+bench::Register for_bench("parallel/for", "elements", [] {
+    return for_on(setup());
+});
+
+bench::Register for4_bench("parallel/for-4", "elements", [] {
+    return for_on(setup4());
+});
+
+}
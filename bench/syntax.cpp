@@ -0,0 +1,71 @@
+#include "Bench.h"
+#include "../src/syntax/Lex.h"
+#include "../src/syntax/parse.h"
+#include "../src/syntax/AST.h"
+
+/* lexing and parsing of a generated source file; the same one each
+   run, so the numbers are comparable between builds */
+
+namespace {
+
+enum { SourceFunctions = 2000 };
+
+const std::string& source ()
+{
+    static std::string src;
+    if (src.empty()) {
+        for (int i = 0; i < SourceFunctions; i++) {
+            src += "fn f" + std::to_string(i) + " (n, m is point%)\n"
+                "  ;; walk up to n, folding into b\n"
+                "  let a = 0\n"
+                "  let b = n * 2 + m.x - " + std::to_string(i) + "\n"
+                "  loop\n"
+                "    if a == n then\n"
+                "      break\n"
+                "    elseif a > 1000000 then\n"
+                "      b = \"too far\"\n"
+                "    else\n"
+                "      a = a + 1\n"
+                "    end\n"
+                "    b = g(b, a) / (a + 1)\n"
+                "    m.y = b\n"
+                "  end\n"
+                "  b\n"
+                "end\n\n";
+        }
+    }
+    return src;
+}
+
+size_t count_nodes (const ast::DefnPtr& defn)
+{
+    size_t nodes = 1;
+    auto fn = dynamic_cast<const ast::FunctionDefn*>(defn.get());
+    if (fn == nullptr)
+        return nodes;
+    for (auto& stmt : fn->body) {
+        nodes++;
+        stmt->traverse([&] (ast::Expr*) { nodes++; });
+    }
+    return nodes;
+}
+
+bench::Register lex_bench("lex", "tokens", [] {
+    lex::Lex lexer(InputSrc::ptr_from_input(source()));
+    size_t tokens = 0;
+    while (lexer.at(0) != lex::Token::EndOfFile) {
+        lexer.take1();
+        tokens++;
+    }
+    return tokens;
+});
+
+bench::Register parse_bench("parse", "nodes", [] {
+    lex::Lex lexer(InputSrc::ptr_from_input(source()));
+    size_t nodes = 0;
+    for (auto& defn : parse::parse_top(lexer))
+        nodes += count_nodes(defn);
+    return nodes;
+});
+
+}
@@ -0,0 +1,154 @@
+#include "Counters.h"
+
+#ifdef ICARUS_COUNTERS
+#include "Program.h"
+#include "../runtime/Function.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <boost/format.hpp>
+
+namespace bytecode {
+namespace counters {
+
+uint64_t opcodes[Kinds];
+uint64_t pairs[Kinds][Kinds];
+
+namespace {
+
+const char* kind_names[Kinds] = {
+    "fxn", "con", "lod", "sto", "glod", "gsto", "fld", "sfld",
+    "call", "tcall", "ret", "jmp", "br",
+};
+
+struct CallSite
+{
+    // copied, since the program may be gone by the time of the report
+    std::string program;
+    std::string function;
+    size_t implementations = 0;
+    uint64_t calls = 0;
+    // calls that picked a different implementation than the call
+    // before; how far the site is from monomorphic
+    uint64_t impl_changes = 0;
+    uint64_t failed = 0;
+    const run::FunctionImpl* last_impl = nullptr;
+};
+
+enum { TopPairs = 40, TopSites = 40 };
+
+struct Report
+{
+    std::mutex lock;
+    std::map<std::pair<const Program*, int>, CallSite> sites;
+
+    ~Report ()
+    {
+        auto path = std::getenv("ICARUS_COUNTERS");
+        if (path) {
+            std::ofstream out(path);
+            write(out);
+        }
+        else {
+            write(std::cerr);
+        }
+    }
+
+    void write (std::ostream& out) const;
+};
+
+Report report;
+
+inline double percent (uint64_t n, uint64_t total)
+{
+    return total ? 100.0 * double(n) / double(total) : 0;
+}
+
+void Report::write (std::ostream& out) const
+{
+    uint64_t total = 0;
+    for (auto n : opcodes)
+        total += n;
+
+    out << "=== opcodes (" << total << " executed)\n";
+    std::vector<int> kinds;
+    for (int k = 0; k < Kinds; k++)
+        kinds.push_back(k);
+    std::sort(kinds.begin(), kinds.end(),
+              [] (int a, int b) { return opcodes[a] > opcodes[b]; });
+    for (auto k : kinds) {
+        if (opcodes[k] == 0)
+            break;
+        out << boost::format("%-6s %14d %6.2f%%\n")
+            % kind_names[k] % opcodes[k] % percent(opcodes[k], total);
+    }
+
+    out << "=== opcode pairs\n";
+    std::vector<std::pair<int, int>> ps;
+    for (int a = 0; a < Kinds; a++)
+        for (int b = 0; b < Kinds; b++)
+            if (pairs[a][b] > 0)
+                ps.emplace_back(a, b);
+    std::sort(ps.begin(), ps.end(),
+              [] (std::pair<int, int> x, std::pair<int, int> y) {
+                  return pairs[x.first][x.second] > pairs[y.first][y.second];
+              });
+    if (ps.size() > TopPairs)
+        ps.resize(TopPairs);
+    for (auto& p : ps) {
+        auto n = pairs[p.first][p.second];
+        out << boost::format("%-6s %-6s %14d %6.2f%%\n")
+            % kind_names[p.first] % kind_names[p.second] % n % percent(n, total);
+    }
+
+    uint64_t calls = 0, changes = 0;
+    std::vector<const std::pair<const std::pair<const Program*, int>, CallSite>*> ss;
+    for (auto& site : sites) {
+        calls += site.second.calls;
+        changes += site.second.impl_changes;
+        ss.push_back(&site);
+    }
+    std::sort(ss.begin(), ss.end(),
+              [] (decltype(ss[0]) x, decltype(ss[0]) y) {
+                  return x->second.calls > y->second.calls;
+              });
+    if (ss.size() > TopSites)
+        ss.resize(TopSites);
+
+    out << "=== call sites (" << sites.size() << " sites, " << calls
+        << " calls, " << changes << " implementation changes)\n";
+    for (auto site : ss) {
+        auto& s = site->second;
+        out << boost::format("%s@%d -> %s: %d calls, %d impls, %d changes, %d failed\n")
+            % s.program % site->first.second % s.function
+            % s.calls % s.implementations % s.impl_changes % s.failed;
+    }
+}
+
+}
+
+void count_call (const Program* prog, int ip,
+                 const run::Function* fn, const run::FunctionImpl* impl)
+{
+    std::lock_guard<std::mutex> guard(report.lock);
+    auto& site = report.sites[std::make_pair(prog, ip)];
+    if (site.calls == 0) {
+        site.program = prog->name.empty() ? "<anonymous>" : prog->name;
+        site.function = fn->name;
+    }
+    site.implementations = fn->implementations.size();
+    site.calls++;
+    if (impl == nullptr)
+        site.failed++;
+    else if (site.last_impl != nullptr && site.last_impl != impl)
+        site.impl_changes++;
+    site.last_impl = impl;
+}
+
+}
+}
+
+#endif
@@ -0,0 +1,46 @@
+#pragma once
+#include "Instruction.h"
+
+/* instrumentation for Program::execute: executions of each opcode,
+   of each pair of consecutive opcodes (candidates for
+   superinstructions), and of each call site. it is compiled in only
+   when ICARUS_COUNTERS is defined, e.g.
+
+     make rebuild cxxflags="-std=c++11 -DICARUS_COUNTERS"
+
+   and the report is written to stderr at exit, or to the file named
+   by $ICARUS_COUNTERS. counts are kept for the whole process, over
+   every State */
+
+#ifdef ICARUS_COUNTERS
+
+namespace run {
+struct Function;
+struct FunctionImpl;
+}
+
+namespace bytecode {
+
+struct Program;
+
+namespace counters {
+
+enum { Kinds = Instruction::Branch + 1 };
+extern uint64_t opcodes[Kinds];
+// indexed by [previous][current]; the first instruction of a
+// program has no previous, and is counted as following a Return
+extern uint64_t pairs[Kinds][Kinds];
+
+inline void count_instruction (Instruction::Kind prev, Instruction::Kind kind)
+{
+    __atomic_fetch_add(&opcodes[kind], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&pairs[prev][kind], 1, __ATOMIC_RELAXED);
+}
+
+void count_call (const Program* prog, int ip,
+                 const run::Function* fn, const run::FunctionImpl* impl);
+
+}
+}
+
+#endif
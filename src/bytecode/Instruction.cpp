@@ -7,6 +7,11 @@ Instruction Instruction::fxn (Fixnum fxn)
     return (Instruction)
         { .kind = Kind::Fxn, .data = { .fxn = fxn } };
 }
+Instruction Instruction::constant (int k)
+{
+    return (Instruction)
+        { .kind = Kind::Const, .data = { .konst = k } };
+}
 Instruction Instruction::load (int src)
 {
     return (Instruction)
@@ -17,6 +22,26 @@ Instruction Instruction::store (int dst)
     return (Instruction)
         { .kind = Kind::Store, .data = { .dst = dst } };
 }
+Instruction Instruction::global_load (run::Symbol glob)
+{
+    return (Instruction)
+        { .kind = Kind::GLoad, .data = { .glob = glob } };
+}
+Instruction Instruction::global_store (run::Symbol glob)
+{
+    return (Instruction)
+        { .kind = Kind::GStore, .data = { .glob = glob } };
+}
+Instruction Instruction::field (int site)
+{
+    return (Instruction)
+        { .kind = Kind::Field, .data = { .field = { 0, site } } };
+}
+Instruction Instruction::set_field (int obj_reg, int site)
+{
+    return (Instruction)
+        { .kind = Kind::SetFld, .data = { .field = { obj_reg, site } } };
+}
 Instruction Instruction::call (run::Function* fn, int first_reg, size_t argc)
 {
     return (Instruction)
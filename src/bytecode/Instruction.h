@@ -1,5 +1,6 @@
 #pragma once
 #include "../runtime/Cell.h"
+#include "../runtime/Symbol.h"
 
 namespace run {
 struct Function;
@@ -12,8 +13,13 @@ struct Instruction
 {
     enum Kind {
         Fxn,    // fxn #<n>             [ tmp <- n ]
+        Const,  // con <k>              [ tmp <- constants[k] ]
         Load,   // lod <rs>             [ tmp <- rs ]
         Store,  // sto <rd>             [ rd <- tmp ]
+        GLoad,  // glod <g>             [ tmp <- globals[g] ]
+        GStore, // gsto <g>             [ globals[g] <- tmp ]
+        Field,  // fld .k               [ tmp <- tmp.k ]
+        SetFld, // sfld <rd>.k          [ rd.k <- tmp ]
         Call,   // call F (rk..r{k+n})  [ tmp <- F(rk, .. r{k+n}) ]
         Tail,   // tcall F (rk..r{k+n}) [ tmp <- F(rk, .. r{k+n}); return tmp ]
         Return, // ret                  [ return tmp ]
@@ -23,8 +29,13 @@ struct Instruction
     Kind kind;
 
     static Instruction fxn (Fixnum fxn);
+    static Instruction constant (int k);
     static Instruction load (int src);
     static Instruction store (int dst);
+    static Instruction global_load (run::Symbol glob);
+    static Instruction global_store (run::Symbol glob);
+    static Instruction field (int site);
+    static Instruction set_field (int obj_reg, int site);
     static Instruction call (run::Function* fn, int first_reg, size_t argc);
     static Instruction tail_call (run::Function* fn, int first_reg, size_t argc);
     static Instruction jump (int loc);
@@ -35,7 +46,9 @@ struct Instruction
         int src;
         int dst;
         Fixnum fxn;
+        int konst;
         int jmp_loc;
+        run::Symbol glob;
 
         struct {
             run::Function* fn;
@@ -43,6 +56,12 @@ struct Instruction
             size_t argc;
         } call;
 
+        struct {
+            int obj_reg;
+            // index into the program's `field_sites'
+            int site;
+        } field;
+
     } data;
 };
 
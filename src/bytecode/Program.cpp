@@ -1,31 +1,216 @@
 #include "Program.h"
+#include "Counters.h"
 #include "../runtime/State.h"
-#include <algorithm>
+#include "../runtime/Profiler.h"
 #include <boost/format.hpp>
+#include <mutex>
 
 namespace bytecode {
 
+namespace {
+
+run::Cell& field_slot_miss (run::Cell inst, const FieldSite& site, FieldCache& cache)
+{
+    auto fields = inst.get_type().fields();
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (fields[i] == site.key) {
+            cache.shape = inst.obj->shape;
+            cache.index = uint32_t(i);
+            return inst.children()[i];
+        }
+    }
+
+    auto fmt = boost::format("instance has no field `%s'") % site.key;
+    throw std::runtime_error(fmt.str());
+}
+
+inline run::Cell& field_slot (run::Cell inst, const FieldSite& site, FieldCache& cache)
+{
+    if (!(inst.is_object() && inst.is_instance())) {
+        auto fmt = boost::format
+            ("cannot access field `%s' of a non-instance") % site.key;
+        throw std::runtime_error(fmt.str());
+    }
+
+    if (inst.obj->shape == cache.shape)
+        return inst.children()[cache.index];
+    else
+        return field_slot_miss(inst, site, cache);
+}
+
+/* program ids, kept dense by reusing those of destroyed programs */
+std::mutex ids_lock;
+std::vector<size_t> free_ids;
+size_t next_id = 0;
+uint64_t next_serial = 1;
+
+void new_id (size_t& id, uint64_t& serial)
+{
+    std::lock_guard<std::mutex> guard(ids_lock);
+    if (free_ids.empty()) {
+        id = next_id++;
+    }
+    else {
+        id = free_ids.back();
+        free_ids.pop_back();
+    }
+    serial = next_serial++;
+}
+
+void free_id (size_t id)
+{
+    std::lock_guard<std::mutex> guard(ids_lock);
+    free_ids.push_back(id);
+}
+
+// pops the innermost activation of `co', returning `acc' from it;
+// true once there's nothing left to return to
+inline bool return_from (run::Coroutine& co, run::Cell acc)
+{
+    co.ret();
+    if (!co.frames.empty())
+        return false;
+    co.result = acc;
+    co.acc = run::Cell::nil();
+    co.status = run::Coroutine::Done;
+    return true;
+}
+
+/* makes `co' the current coroutine for as long as it runs */
+struct Running
+{
+    Running (run::State* st, run::Coroutine& c)
+        : state(st)
+        , co(c)
+    {
+        co.caller = state->current_coroutine;
+        co.status = run::Coroutine::Running;
+        state->current_coroutine = &co;
+    }
+    ~Running ()
+    {
+        state->current_coroutine = co.caller;
+        co.caller = nullptr;
+    }
+
+    run::State* state;
+    run::Coroutine& co;
+};
+
+}
+
+Program::Program (size_t argc)
+    : arg_count(argc)
+    , reg_count(argc)
+{
+    new_id(id_, serial_);
+}
+
+Program::Program (const Program& other)
+    : name(other.name)
+    , arg_count(other.arg_count)
+    , reg_count(other.reg_count)
+    , instructions(other.instructions)
+    , constants(other.constants)
+    , field_sites(other.field_sites)
+{
+    new_id(id_, serial_);
+}
+
+Program& Program::operator= (const Program& other)
+{
+    name = other.name;
+    arg_count = other.arg_count;
+    reg_count = other.reg_count;
+    instructions = other.instructions;
+    constants = other.constants;
+    field_sites = other.field_sites;
+    /* a new serial, so that caches for the old code aren't used */
+    free_id(id_);
+    new_id(id_, serial_);
+    return *this;
+}
+
+Program::~Program ()
+{
+    free_id(id_);
+}
+
+int Program::add_constant (run::Cell value)
+{
+    constants.push_back(value);
+    return int(constants.size() - 1);
+}
+
+int Program::add_field_site (std::string key)
+{
+    field_sites.emplace_back(std::move(key));
+    return int(field_sites.size() - 1);
+}
+
 run::Cell Program::execute (run::State* state, run::Cell* argv) const
 {
-    /* create register, copy arguments */
-    run::Cell acc = run::Cell::nil();
-    std::vector<run::Cell> regs;
-    regs.resize(reg_count, run::Cell::nil());
-    for (size_t i = 0; i < arg_count; i++)
-        regs[i] = argv[i];
-    // TODO: add to GC roots
+    auto co = state->take_coroutine();
+    try {
+        co->enter(this, argv);
+        interpret(state, *co);
+    }
+    catch (...) {
+        state->give_coroutine(std::move(co));
+        throw;
+    }
+    auto result = co->result;
+    state->give_coroutine(std::move(co));
+    return result;
+}
 
+void interpret (run::State* state, run::Coroutine& co)
+{
+    Running running(state, co);
 
-    /* interpret instructions */
+    /* the innermost activation is kept in locals, and only written
+       back to the coroutine where something else may look at it: the
+       accumulator before a collection or a call to native code, and
+       the ip before any call */
+    const Program* prog = nullptr;
+    run::Activation* act = nullptr;
+    run::Cell* regs = nullptr;
+    FieldCache* caches = nullptr;
     int ip = 0;
-    bool ret = false;
-    while (!ret) {
-        auto ins = instructions[ip++];
+    auto load = [&] {
+        act = &co.frames.back();
+        prog = act->program;
+        regs = co.regs.data() + act->base;
+        caches = act->caches;
+        ip = act->ip;
+    };
+
+    run::Cell acc = co.acc;
+    if (co.return_on_resume) {
+        co.return_on_resume = false;
+        if (return_from(co, acc))
+            return;
+    }
+    load();
+#ifdef ICARUS_COUNTERS
+    auto prev_kind = Instruction::Return;
+#endif
+
+    for (;;) {
+        auto ins = prog->instructions[ip++];
+#ifdef ICARUS_COUNTERS
+        counters::count_instruction(prev_kind, ins.kind);
+        prev_kind = ins.kind;
+#endif
         switch (ins.kind) {
         case Instruction::Fxn:
             acc = run::Cell::from_fixnum(ins.data.fxn);
             break;
 
+        case Instruction::Const:
+            acc = prog->constants[ins.data.konst];
+            break;
+
         case Instruction::Load:
             acc = regs[ins.data.src];
             break;
@@ -34,44 +219,105 @@ run::Cell Program::execute (run::State* state, run::Cell* argv) const
             regs[ins.data.dst] = acc;
             break;
 
+        case Instruction::GLoad:
+            acc = state->env.globals[ins.data.glob];
+            break;
+
+        case Instruction::GStore:
+            state->env.globals[ins.data.glob] = acc;
+            break;
+
+        case Instruction::Field:
+            acc = field_slot(acc, prog->field_sites[ins.data.field.site],
+                             caches[ins.data.field.site]);
+            break;
+
+        case Instruction::SetFld:
+            state->gc.write_barrier(acc);
+            field_slot(regs[ins.data.field.obj_reg],
+                       prog->field_sites[ins.data.field.site],
+                       caches[ins.data.field.site]) = acc;
+            break;
+
         case Instruction::Call:
         case Instruction::Tail:
             {
+                act->ip = ip;
+                if (state->gc.wants_collect()) {
+                    co.acc = acc;
+                    state->gc.safepoint(state);
+                    acc = co.acc;
+                }
+                if (run::profile_tick.load(std::memory_order_relaxed))
+                    run::Profiler::tick(state, ip - 1);
+
                 auto fn = ins.data.call.fn;
-                auto& impls = fn->implementations;
+                auto args = regs + ins.data.call.first_reg;
                 size_t argc = ins.data.call.argc;
-                auto it = std::find_if(impls.begin(), impls.end(),
-                                       [argc] (run::FunctionImpl& impl)
-                                       { return impl.arg_count == argc; });
-                if (it == impls.end()) {
+                auto impl = fn->dispatch(args, argc);
+#ifdef ICARUS_COUNTERS
+                counters::count_call(prog, ip - 1, fn, impl);
+#endif
+                if (impl == nullptr) {
                     auto fmt = boost::format
-                        ("no matching implementation of function `%s' with %d argument(s)")
+                        ("no implementation of function `%s' matches the given %d argument(s)")
                         % fn->name % argc;
                     throw std::runtime_error(fmt.str());
                 }
 
-                acc = it->call(state, regs.data() + ins.data.call.first_reg);
-                if (ins.kind == Instruction::Tail)
-                    ret = true;
+                if (impl->program) {
+                    if (ins.kind == Instruction::Tail)
+                        co.tail_call(impl->program, ins.data.call.first_reg);
+                    else
+                        co.call(impl->program, ins.data.call.first_reg);
+                    load();
+                    break;
+                }
+
+                co.acc = acc;
+                acc = impl->native_fn_ptr ? impl->native_fn_ptr(state, args)
+                                          : impl->call(state, args);
+                if (co.suspending) {
+                    /* woken with the result of the call; the native
+                       function may already have done so */
+                    co.suspending = false;
+                    co.return_on_resume = (ins.kind == Instruction::Tail);
+                    if (co.status == run::Coroutine::Running)
+                        co.status = run::Coroutine::Suspended;
+                    return;
+                }
+                if (ins.kind == Instruction::Tail) {
+                    if (return_from(co, acc))
+                        return;
+                    load();
+                }
                 break;
             }
 
         case Instruction::Jump:
+            if (state->gc.wants_collect()) {
+                co.acc = acc;
+                state->gc.safepoint(state);
+                acc = co.acc;
+            }
+            if (run::profile_tick.load(std::memory_order_relaxed))
+                run::Profiler::tick(state, ip - 1);
             ip = ins.data.jmp_loc;
             break;
 
         case Instruction::Branch:
-            if (acc.obj == run::Cell::false_object.obj)
+            if (acc.is_false())
                 ip = ins.data.jmp_loc;
             break;
 
         default:
         case Instruction::Return:
-            ret = true;
+            if (return_from(co, acc))
+                return;
+            load();
             break;
         }
     }
-    return acc;
 }
 
 }
@@ -1,27 +1,91 @@
 #pragma once
 #include "Instruction.h"
 #include <vector>
+#include <string>
 
 
 namespace run {
 struct State;
+struct Coroutine;
 }
 
 
 namespace bytecode {
 
-struct Program
+/* a field access instruction's key. programs are never changed by
+   running them, so that a program may be shared by States; the
+   inline cache for each site is kept by the State instead (see
+   FieldCache) */
+struct FieldSite
 {
-    Program (size_t argc)
-        : arg_count(argc)
-        , reg_count(argc)
+    explicit FieldSite (std::string k)
+        : key(std::move(k))
     {}
 
+    std::string key;
+};
+
+/* inline cache for a field site. the key is resolved to a child
+   index the first time an instance reaches the site, and reused for
+   as long as instances of the same datatype (by Object::shape, which
+   is never zero for an instance) do. */
+struct FieldCache
+{
+    uint16_t shape = 0;
+    uint32_t index = 0;
+};
+
+// a State's caches for one program, see run::State::field_caches()
+struct ProgramCaches
+{
+    uint64_t serial = 0;
+    std::vector<FieldCache> fields;
+};
+
+struct Program
+{
+    Program (size_t argc);
+    // copies are new programs, with ids of their own
+    Program (const Program& other);
+    Program& operator= (const Program& other);
+    ~Program ();
+
+    // for profiles and statistics
+    std::string name;
     size_t arg_count;
     size_t reg_count;
     std::vector<Instruction> instructions;
+    // literal values; must be pinned or otherwise kept alive, see
+    // run::State::intern_constant() and run::Image::constant()
+    std::vector<run::Cell> constants;
+    std::vector<FieldSite> field_sites;
+
+    // returns the index to give to con instructions
+    int add_constant (run::Cell value);
 
+    // returns the site number to give to field instructions
+    int add_field_site (std::string key);
+
+    // runs to completion in a coroutine of its own, which can't be
+    // suspended
     run::Cell execute (run::State* state, run::Cell* argv) const;
+
+    // small and dense, for States to index their caches with; reused
+    // once a program is destroyed. the serial number never is
+    inline size_t id () const
+    { return id_; }
+    inline uint64_t serial () const
+    { return serial_; }
+
+private:
+    size_t id_;
+    uint64_t serial_;
 };
 
+/* runs `co' until it finishes, or stops at a call to a native
+   function that suspends it. calls between bytecode functions
+   don't recurse, so only calls to native functions use the C++
+   stack */
+void interpret (run::State* state, run::Coroutine& co);
+
 }
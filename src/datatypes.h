@@ -2,3 +2,7 @@
 #include <cstdint>
 
 using Fixnum = std::intptr_t;
+
+// fixnums give up one bit to the cell tag
+const Fixnum FixnumMax = INTPTR_MAX >> 1;
+const Fixnum FixnumMin = INTPTR_MIN >> 1;
@@ -1,42 +1,552 @@
 #include "../runtime/State.h"
+#include "../runtime/Bignum.h"
+#include "../runtime/Channel.h"
+#include "../runtime/Collections.h"
+#include "../runtime/Image.h"
+#include "../runtime/Packed.h"
+#include "../runtime/Pool.h"
+#include <boost/format.hpp>
 
 namespace run {
 
 namespace {
 
+/* fixnums are tagged as 2n + 1, so the tagged sum of n and m is
+   a + (b - 1), and the cpu's overflow flag tells us exactly when
+   the result doesn't fit a fixnum */
 Cell proc_add (State* s, Cell* args)
 {
-    (void) s;
-    if (args[0].is_integer() && args[1].is_integer()) {
-        Fixnum fx = args[0].integer() + args[1].integer();
-        return Cell::from_fixnum(fx);
-    }
-    else
-        return Cell::nil();
+    intptr_t sum;
+    if (args[0].is_integer() && args[1].is_integer()
+        && !__builtin_add_overflow(intptr_t(args[0].obj),
+                                   intptr_t(args[1].obj) - 1, &sum))
+        return Cell((Object*) sum);
+
+    return bignum::add(s->gc, args[0], args[1]);
 }
 
 Cell proc_sub (State* s, Cell* args)
+{
+    intptr_t diff;
+    if (args[0].is_integer() && args[1].is_integer()
+        && !__builtin_sub_overflow(intptr_t(args[0].obj),
+                                   intptr_t(args[1].obj) - 1, &diff))
+        return Cell((Object*) diff);
+
+    return bignum::sub(s->gc, args[0], args[1]);
+}
+
+Cell proc_mul (State* s, Cell* args)
+{
+    return bignum::mul(s->gc, args[0], args[1]);
+}
+
+Cell proc_div (State* s, Cell* args)
+{
+    return bignum::div(s->gc, args[0], args[1]);
+}
+
+// floats mixed with integers are promoted
+inline double to_double (Cell x)
+{
+    return x.is_float() ? x.floating() : bignum::to_double(x);
+}
+
+Cell proc_add_float (State* s, Cell* args)
+{
+    return s->gc.make_float(to_double(args[0]) + to_double(args[1]));
+}
+
+Cell proc_sub_float (State* s, Cell* args)
+{
+    return s->gc.make_float(to_double(args[0]) - to_double(args[1]));
+}
+
+Cell proc_mul_float (State* s, Cell* args)
+{
+    return s->gc.make_float(to_double(args[0]) * to_double(args[1]));
+}
+
+Cell proc_div_float (State* s, Cell* args)
+{
+    return s->gc.make_float(to_double(args[0]) / to_double(args[1]));
+}
+
+Cell proc_less_float (State* s, Cell* args)
+{
+    (void) s;
+    bool cond = to_double(args[0]) < to_double(args[1]);
+    return Cell::from_bool(cond);
+}
+
+Cell proc_concat (State* s, Cell* args)
+{
+    return s->gc.concat(args[0], args[1]);
+}
+
+Cell proc_less (State* s, Cell* args)
 {
     (void) s;
     if (args[0].is_integer() && args[1].is_integer()) {
-        Fixnum fx = args[0].integer() - args[1].integer();
-        return Cell::from_fixnum(fx);
+        bool cond = args[0].integer() < args[1].integer();
+        return Cell::from_bool(cond);
+    }
+    else if (bignum::is_integral(args[0]) && bignum::is_integral(args[1])) {
+        return Cell::from_bool(bignum::compare(args[0], args[1]) < 0);
     }
     else
         return Cell::nil();
 }
 
-Cell proc_less (State* s, Cell* args)
+
+
+/* collections */
+
+Fixnum index_arg (Cell x)
+{
+    if (!x.is_integer())
+        throw std::runtime_error("index must be an integer");
+    return x.integer();
+}
+
+Cell proc_vector (State* s, Cell* args)
+{
+    (void) args;
+    return s->gc.make_vector();
+}
+
+Cell proc_push (State* s, Cell* args)
+{
+    vector_push(s->gc, args[0], args[1]);
+    return args[0];
+}
+
+Cell proc_pop (State* s, Cell* args)
 {
     (void) s;
-    if (args[0].is_integer() && args[1].is_integer()) {
-        bool cond = args[0].integer() < args[1].integer();
-        return cond ? Cell::true_object : Cell::false_object;
+    return vector_pop(args[0]);
+}
+
+Cell proc_vector_get (State* s, Cell* args)
+{
+    (void) s;
+    return vector_at(args[0], index_arg(args[1]));
+}
+
+Cell proc_vector_set (State* s, Cell* args)
+{
+    s->gc.write_barrier(args[2]);
+    vector_at(args[0], index_arg(args[1])) = args[2];
+    return args[2];
+}
+
+Cell& array_slot (Cell arr, Cell index)
+{
+    auto elems = arr.children();
+    auto i = index_arg(index);
+    if (i < 0 || i >= Fixnum(elems.size())) {
+        auto fmt = boost::format
+            ("index %d out of range for array of length %d") % i % elems.size();
+        throw std::runtime_error(fmt.str());
     }
+    return elems[i];
+}
+
+Cell proc_array_get (State* s, Cell* args)
+{
+    (void) s;
+    return array_slot(args[0], args[1]);
+}
+
+Cell proc_array_set (State* s, Cell* args)
+{
+    s->gc.write_barrier(args[2]);
+    array_slot(args[0], args[1]) = args[2];
+    return args[2];
+}
+
+Cell proc_table (State* s, Cell* args)
+{
+    (void) args;
+    return s->gc.make_table();
+}
+
+// null if not found
+Cell proc_table_get (State* s, Cell* args)
+{
+    (void) s;
+    Cell value;
+    table_get(args[0], args[1], value);
+    return value;
+}
+
+Cell proc_table_set (State* s, Cell* args)
+{
+    table_set(s->gc, args[0], args[1], args[2]);
+    return args[2];
+}
+
+Cell proc_table_has (State* s, Cell* args)
+{
+    (void) s;
+    Cell value;
+    return Cell::from_bool(table_get(args[0], args[1], value));
+}
+
+Cell proc_table_remove (State* s, Cell* args)
+{
+    (void) s;
+    return Cell::from_bool(table_remove(args[0], args[1]));
+}
+
+/* packed arrays */
+
+Cell make_packed (State* s, uint8_t kind, Cell length)
+{
+    auto n = index_arg(length);
+    if (n < 0 || size_t(n) * Object::packed_elem_size(kind) > UINT32_MAX)
+        throw std::runtime_error("bad length for packed array");
+    return s->gc.make_packed(kind, size_t(n));
+}
+
+Cell proc_bytes (State* s, Cell* args)
+{
+    return make_packed(s, Object::Bytes, args[0]);
+}
+
+Cell proc_int32s (State* s, Cell* args)
+{
+    return make_packed(s, Object::Int32s, args[0]);
+}
+
+Cell proc_int64s (State* s, Cell* args)
+{
+    return make_packed(s, Object::Int64s, args[0]);
+}
+
+Cell proc_packed_get (State* s, Cell* args)
+{
+    return packed_get(s->gc, args[0], index_arg(args[1]));
+}
+
+Cell proc_packed_set (State* s, Cell* args)
+{
+    (void) s;
+    packed_set(args[0], index_arg(args[1]), args[2]);
+    return args[2];
+}
+
+Cell proc_packed_fill (State* s, Cell* args)
+{
+    (void) s;
+    packed_fill(args[0], args[1]);
+    return args[0];
+}
+
+// copy(dst, dst_start, src, src_start, count)
+Cell proc_packed_copy (State* s, Cell* args)
+{
+    (void) s;
+    packed_copy(args[0], index_arg(args[1]),
+                args[2], index_arg(args[3]), index_arg(args[4]));
+    return args[0];
+}
+
+Cell proc_packed_sum (State* s, Cell* args)
+{
+    return packed_sum(s->gc, args[0]);
+}
+
+// -1 if not found
+Cell proc_packed_find (State* s, Cell* args)
+{
+    (void) s;
+    return Cell::from_fixnum(packed_find(args[0], args[1]));
+}
+
+Cell proc_len (State* s, Cell* args)
+{
+    (void) s;
+    auto x = args[0];
+    if (x.is_string())
+        return Cell::from_fixnum(Fixnum(x.string().size()));
+    if (!x.is_object())
+        return Cell::nil();
+    else if (x.is_vector())
+        return Cell::from_fixnum(Fixnum(vector_length(x)));
+    else if (x.is_table())
+        return Cell::from_fixnum(Fixnum(table_count(x)));
+    else if (x.is_array())
+        return Cell::from_fixnum(Fixnum(x.children().size()));
+    else if (x.is_packed())
+        return Cell::from_fixnum(Fixnum(x.packed_length()));
     else
         return Cell::nil();
 }
 
+// spawn(name, args...): runs the function called `name' in a coroutine
+// of its own, once the scheduler gets to it
+template <size_t N>
+Cell proc_spawn (State* s, Cell* args)
+{
+    auto name = args[0].string().to_string();
+    auto fn = s->env.get_function(name);
+    if (fn == nullptr) {
+        auto fmt = boost::format("no function `%s'") % name;
+        throw std::runtime_error(fmt.str());
+    }
+    s->spawn(fn, args + 1, N);
+    return Cell::nil();
+}
+
+Cell proc_yield (State* s, Cell* args)
+{
+    (void) args;
+    s->yield();
+    return Cell::nil();
+}
+
+
+
+/* parallel map/reduce. the array is split into pieces, each sent to
+   a worker of the image's pool (see Pool and Message) which calls the
+   function on a copy of it in an isolate of its own, and what every
+   piece gives back is sent back into this State. so the function has
+   to be defined in the image, and only sees the globals of its worker.
+   without a pool to use (a call from a worker, or a pool of one) the
+   whole array is done here instead, under the same rules. whatever
+   else a worker changes is lost along with its copy, so the parallel
+   "for each" is over packed arrays, whose pieces are moved to the
+   workers and back with the changes to their elements */
+
+// pieces per worker, so that stealing can even out uneven work
+enum { PiecesPerWorker = 4 };
+
+Cell call_function (State& s, Function* fn, Cell* args, size_t argc)
+{
+    auto impl = fn->dispatch(args, argc);
+    if (impl == nullptr) {
+        auto fmt = boost::format
+            ("no implementation of function `%s' matches the given %d argument(s)")
+            % fn->name % argc;
+        throw std::runtime_error(fmt.str());
+    }
+    return impl->call(&s, args);
+}
+
+/* the function called `name' as the image defines it, which is what
+   the workers will call. one defined in this State alone would work
+   whenever the array is done here and fail when it's split up, so it
+   isn't allowed either way */
+Function* image_function (State& s, const std::string& name)
+{
+    if (s.image == nullptr)
+        throw std::runtime_error("parallel calls need a State made from an image");
+    Symbol sym;
+    auto& env = s.image->env;
+    if (!env.symbols.find(name, sym) || env.functions[sym] == nullptr) {
+        auto fmt = boost::format("no function `%s' in the image") % name;
+        throw std::runtime_error(fmt.str());
+    }
+    return env.functions[sym];
+}
+
+// of arrays and vectors alike
+size_t length_of (Cell xs)
+{
+    return xs.is_vector() ? vector_length(xs) : xs.children().size();
+}
+
+Cell element_of (Cell xs, size_t i)
+{
+    return xs.is_vector() ? vector_at(xs, Fixnum(i)) : xs.children()[i];
+}
+
+// elements `begin' to `end' of `xs', in an array
+Cell slice_of (GC& gc, Cell xs, size_t begin, size_t end)
+{
+    auto piece = gc.make_array(end - begin);
+    for (size_t i = begin; i < end; i++) {
+        auto x = element_of(xs, i);
+        gc.write_barrier(x);
+        piece.children()[i - begin] = x;
+    }
+    return piece;
+}
+
+/* what's done with each piece, an array that isn't empty */
+typedef Cell (*PieceFn) (State& s, Function* fn, Cell piece);
+
+// fn(x) for every x, in an array
+Cell map_piece (State& s, Function* fn, Cell piece)
+{
+    // the piece, the results, and the argument
+    Cell regs[3] = { piece, Cell::nil(), Cell::nil() };
+    Cell result;
+    Frame frame(&s, regs, 3, &result);
+    size_t n = piece.children().size();
+    regs[1] = s.gc.make_array(n);
+    for (size_t i = 0; i < n; i++) {
+        regs[2] = regs[0].children()[i];
+        result = call_function(s, fn, &regs[2], 1);
+        s.gc.write_barrier(result);
+        regs[1].children()[i] = result;
+    }
+    return regs[1];
+}
+
+// fn(..fn(fn(x0, x1), x2).., xn)
+Cell reduce_piece (State& s, Function* fn, Cell piece)
+{
+    // the piece, then the arguments: the result so far and the next
+    Cell regs[3] = { piece, piece.children()[0], Cell::nil() };
+    Cell result;
+    Frame frame(&s, regs, 3, &result);
+    size_t n = piece.children().size();
+    for (size_t i = 1; i < n; i++) {
+        regs[2] = regs[0].children()[i];
+        regs[1] = call_function(s, fn, &regs[1], 2);
+    }
+    return regs[1];
+}
+
+// the pool to split `n' elements over, or null to do them all here
+Pool* pool_for (State* s, size_t n)
+{
+    if (Pool::on_worker() || n < 2 || s->image->pool().workers() < 2)
+        return nullptr;
+    return &s->image->pool();
+}
+
+// an array of what `each' gives for every piece of `xs', in order.
+// `xs' mustn't be empty
+Cell run_pieces (State* s, Cell name, Cell xs, PieceFn each)
+{
+    auto fn_name = name.string().to_string();
+    auto fn = image_function(*s, fn_name);
+    size_t n = length_of(xs);
+    auto pool = pool_for(s, n);
+
+    if (!pool) {
+        Cell piece = xs.is_vector() ? slice_of(s->gc, xs, 0, n) : xs, result;
+        Frame frame(s, &piece, 1, &result);
+        result = each(*s, fn, piece);
+        auto results = s->gc.make_array(1);
+        s->gc.write_barrier(result);
+        results.children()[0] = result;
+        return results;
+    }
+
+    size_t pieces = std::min<size_t>(n, pool->workers() * PiecesPerWorker);
+    std::vector<Message> inputs(pieces), outputs(pieces);
+    for (size_t p = 0; p < pieces; p++)
+        inputs[p] = Message::pack(slice_of(s->gc, xs, n * p / pieces, n * (p + 1) / pieces));
+
+    pool->run(pieces, [&] (State& st, size_t p) {
+        Cell piece = inputs[p].unpack(st), result;
+        Frame frame(&st, &piece, 1, &result);
+        result = each(st, image_function(st, fn_name), piece);
+        outputs[p] = Message::pack(result);
+    });
+
+    Cell results = s->gc.make_array(pieces), result;
+    Frame frame(s, &results, 1, &result);
+    for (size_t p = 0; p < pieces; p++) {
+        result = outputs[p].unpack(*s);
+        s->gc.write_barrier(result);
+        results.children()[p] = result;
+    }
+    return results;
+}
+
+// parallel_map(name, xs): an array of name(x) for every x in xs
+Cell proc_parallel_map (State* s, Cell* args)
+{
+    // checked even when there's nothing to call it on
+    image_function(*s, args[0].string().to_string());
+    if (length_of(args[1]) == 0)
+        return s->gc.make_array(0);
+
+    Cell results = run_pieces(s, args[0], args[1], map_piece), mapped;
+    if (results.children().size() == 1)
+        return results.children()[0];
+
+    Frame frame(s, &results, 1, &mapped);
+    mapped = s->gc.make_array(length_of(args[1]));
+    size_t i = 0;
+    for (auto piece : results.children())
+        for (auto x : piece.children()) {
+            s->gc.write_barrier(x);
+            mapped.children()[i++] = x;
+        }
+    return mapped;
+}
+
+// parallel_reduce(name, xs, init): name(..name(name(init, x0), x1).., xn),
+// as long as name is associative, since the pieces are reduced apart
+Cell proc_parallel_reduce (State* s, Cell* args)
+{
+    auto fn = image_function(*s, args[0].string().to_string());
+    if (length_of(args[1]) == 0)
+        return args[2];
+
+    // the results of the pieces, then the arguments: the result so far
+    // and the next
+    Cell regs[3] = { run_pieces(s, args[0], args[1], reduce_piece), args[2], Cell::nil() };
+    Cell result;
+    Frame frame(s, regs, 3, &result);
+    size_t pieces = regs[0].children().size();
+    for (size_t p = 0; p < pieces; p++) {
+        regs[2] = regs[0].children()[p];
+        regs[1] = call_function(*s, fn, &regs[1], 2);
+    }
+    return regs[1];
+}
+
+// parallel_for(name, xs): name(piece) for pieces covering the packed
+// array xs, each a packed array of a range of its elements. whatever
+// name stores into the elements of a piece ends up in xs
+Cell proc_parallel_for (State* s, Cell* args)
+{
+    auto fn_name = args[0].string().to_string();
+    auto fn = image_function(*s, fn_name);
+    size_t n = args[1].packed_length();
+    auto pool = pool_for(s, n);
+
+    if (!pool) {
+        // the whole array is the one piece
+        Cell piece = args[1], result;
+        Frame frame(s, &piece, 1, &result);
+        if (n > 0)
+            call_function(*s, fn, &piece, 1);
+        return Cell::nil();
+    }
+
+    /* each piece is copied out of xs, and then moved rather than
+       copied on its way to the worker and back */
+    size_t pieces = std::min<size_t>(n, pool->workers() * PiecesPerWorker);
+    std::vector<Message> messages(pieces);
+    for (size_t p = 0; p < pieces; p++) {
+        size_t begin = n * p / pieces, end = n * (p + 1) / pieces;
+        auto piece = s->gc.make_packed(args[1].obj->kind(), end - begin);
+        packed_copy(piece, 0, args[1], Fixnum(begin), Fixnum(end - begin));
+        messages[p] = Message::pack(piece, true);
+    }
+
+    pool->run(pieces, [&] (State& st, size_t p) {
+        Cell piece = messages[p].unpack(st), result;
+        Frame frame(&st, &piece, 1, &result);
+        call_function(st, image_function(st, fn_name), &piece, 1);
+        messages[p] = Message::pack(piece, true);
+    });
+
+    for (size_t p = 0; p < pieces; p++) {
+        size_t begin = n * p / pieces, end = n * (p + 1) / pieces;
+        auto piece = messages[p].unpack(*s);
+        packed_copy(args[1], Fixnum(begin), piece, 0, Fixnum(end - begin));
+    }
+    return Cell::nil();
+}
 
 
 
@@ -45,7 +555,25 @@ inline void impl (Environment* env,
                   size_t argc,
                   NativeFnPtr nfptr)
 {
-    env->impl_function(name, argc).native_fn_ptr = nfptr;
+    env->impl_function(name, FunctionImpl(argc, nfptr));
+}
+
+inline void impl (Environment* env,
+                  const std::string& name,
+                  std::vector<Cell> arg_types,
+                  NativeFnPtr nfptr)
+{
+    env->impl_function(name, FunctionImpl(std::move(arg_types), nfptr));
+}
+
+// implement a binary operator for floats, and floats mixed with integers
+inline void impl_float (Environment* env,
+                        const std::string& name,
+                        NativeFnPtr nfptr)
+{
+    impl(env, name, { Cell::float_type, Cell::float_type }, nfptr);
+    impl(env, name, { Cell::float_type, Cell::int_type }, nfptr);
+    impl(env, name, { Cell::int_type, Cell::float_type }, nfptr);
 }
 
 }
@@ -53,8 +581,53 @@ inline void impl (Environment* env,
 void Environment::load_std_lib ()
 {
     impl(this, "+", 2, proc_add);
+    impl(this, "+", { Cell::string_type, Cell::string_type }, proc_concat);
     impl(this, "-", 2, proc_sub);
+    impl(this, "*", 2, proc_mul);
+    impl(this, "/", 2, proc_div);
     impl(this, "<", 2, proc_less);
+    impl(this, "len", 1, proc_len);
+    impl(this, "vector", 0, proc_vector);
+    impl(this, "push", { Cell::vector_type, Cell::nil() }, proc_push);
+    impl(this, "pop", { Cell::vector_type }, proc_pop);
+    impl(this, "get", { Cell::vector_type, Cell::nil() }, proc_vector_get);
+    impl(this, "get=", { Cell::vector_type, Cell::nil(), Cell::nil() }, proc_vector_set);
+    impl(this, "get", { Cell::array_type, Cell::nil() }, proc_array_get);
+    impl(this, "get=", { Cell::array_type, Cell::nil(), Cell::nil() }, proc_array_set);
+    impl(this, "table", 0, proc_table);
+    impl(this, "get", { Cell::table_type, Cell::nil() }, proc_table_get);
+    impl(this, "get=", { Cell::table_type, Cell::nil(), Cell::nil() }, proc_table_set);
+    impl(this, "has", { Cell::table_type, Cell::nil() }, proc_table_has);
+    impl(this, "remove", { Cell::table_type, Cell::nil() }, proc_table_remove);
+    impl(this, "bytes", { Cell::int_type }, proc_bytes);
+    impl(this, "int32s", { Cell::int_type }, proc_int32s);
+    impl(this, "int64s", { Cell::int_type }, proc_int64s);
+    for (auto type : { Cell::bytes_type, Cell::int32s_type, Cell::int64s_type }) {
+        impl(this, "get", { type, Cell::nil() }, proc_packed_get);
+        impl(this, "get=", { type, Cell::nil(), Cell::nil() }, proc_packed_set);
+        impl(this, "fill", { type, Cell::nil() }, proc_packed_fill);
+        impl(this, "copy", { type, Cell::nil(), type, Cell::nil(), Cell::nil() },
+             proc_packed_copy);
+        impl(this, "sum", { type }, proc_packed_sum);
+        impl(this, "find", { type, Cell::nil() }, proc_packed_find);
+        impl(this, "parallel_for", { Cell::string_type, type }, proc_parallel_for);
+    }
+    impl(this, "spawn", { Cell::string_type }, proc_spawn<0>);
+    impl(this, "spawn", { Cell::string_type, Cell::nil() }, proc_spawn<1>);
+    impl(this, "spawn", { Cell::string_type, Cell::nil(), Cell::nil() }, proc_spawn<2>);
+    impl(this, "spawn", { Cell::string_type, Cell::nil(), Cell::nil(), Cell::nil() },
+         proc_spawn<3>);
+    impl(this, "yield", 0, proc_yield);
+    for (auto type : { Cell::array_type, Cell::vector_type }) {
+        impl(this, "parallel_map", { Cell::string_type, type }, proc_parallel_map);
+        impl(this, "parallel_reduce", { Cell::string_type, type, Cell::nil() },
+             proc_parallel_reduce);
+    }
+    impl_float(this, "+", proc_add_float);
+    impl_float(this, "-", proc_sub_float);
+    impl_float(this, "*", proc_mul_float);
+    impl_float(this, "/", proc_div_float);
+    impl_float(this, "<", proc_less_float);
 }
 
 }
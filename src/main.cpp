@@ -1,18 +1,29 @@
 #include <iostream>
+#include <fstream>
+#include <cstdlib>
 #include <utf8.h>
 #include <boost/format.hpp>
 #include "bytecode/Program.h"
 #include "runtime/State.h"
+#include "runtime/Profiler.h"
 
 int main (void)
 {
     try {
         run::State state;
+
+        /* ICARUS_PROFILE=file writes a folded-stack profile to file */
+        run::Profiler profiler;
+        auto profile_path = std::getenv("ICARUS_PROFILE");
+        if (profile_path)
+            profiler.start();
+
         auto plus = state.env.get_function("+");
         if (!plus) throw std::runtime_error("no standard `+' function");
 
         /* fn main () 4 + 5 end */
         bytecode::Program p_main(0);
+        p_main.name = "main";
         p_main.reg_count = 2;
         using I = bytecode::Instruction;
         auto& ins = p_main.instructions;
@@ -24,6 +35,11 @@ int main (void)
         ins.push_back(I::ret());
 
         auto ret = p_main.execute(&state, nullptr);
+        if (profile_path) {
+            profiler.stop();
+            std::ofstream out(profile_path);
+            profiler.write_folded(out);
+        }
         if (ret.is_integer())
             std::cout << "output: " << ret.integer() << std::endl;
         else if (ret.is_null())
@@ -0,0 +1,465 @@
+#include "Bignum.h"
+#include "GC.h"
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+namespace run {
+namespace bignum {
+
+namespace {
+
+/* magnitudes are vectors of 32-bit limbs, least significant first,
+   with no most significant zero limbs. zero is the empty vector */
+using Mag = std::vector<uint32_t>;
+
+// operands shorter than this (in limbs) use schoolbook multiplication
+const size_t KaratsubaThreshold = 32;
+
+struct Int
+{
+    bool negative;
+    Mag mag;
+};
+
+inline void trim (Mag& m)
+{
+    while (!m.empty() && m.back() == 0)
+        m.pop_back();
+}
+
+Int unpack (Cell x)
+{
+    Int r;
+    if (x.is_integer()) {
+        Fixnum fx = x.integer();
+        r.negative = fx < 0;
+        uint64_t u = r.negative ? uint64_t(0) - uint64_t(fx) : uint64_t(fx);
+        for (; u != 0; u >>= 32)
+            r.mag.push_back(uint32_t(u));
+    }
+    else {
+        auto& desc = *x.obj->data_as_bignum();
+        r.negative = desc.negative;
+        r.mag.assign(desc.limbs, desc.limbs + desc.count);
+    }
+    return r;
+}
+
+Cell pack (GC& gc, bool negative, Mag& mag)
+{
+    trim(mag);
+    if (mag.size() <= 2) {
+        uint64_t u = 0;
+        if (mag.size() > 0) u |= mag[0];
+        if (mag.size() > 1) u |= uint64_t(mag[1]) << 32;
+
+        if (u == 0)
+            return Cell::from_fixnum(0);
+        if (!negative && u <= uint64_t(FixnumMax))
+            return Cell::from_fixnum(Fixnum(u));
+        if (negative && u - 1 <= uint64_t(FixnumMax))
+            return Cell::from_fixnum(-Fixnum(u - 1) - 1);
+    }
+    return gc.make_bignum(negative, mag.data(), mag.size());
+}
+
+int cmp_mag (const Mag& a, const Mag& b)
+{
+    if (a.size() != b.size())
+        return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i-- > 0; )
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    return 0;
+}
+
+Mag add_mag (const Mag& a, const Mag& b)
+{
+    const Mag& lo = a.size() < b.size() ? a : b;
+    const Mag& hi = a.size() < b.size() ? b : a;
+    Mag r(hi.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < hi.size(); i++) {
+        carry += uint64_t(hi[i]) + (i < lo.size() ? lo[i] : 0);
+        r[i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    r[hi.size()] = uint32_t(carry);
+    trim(r);
+    return r;
+}
+
+// requires a >= b
+Mag sub_mag (const Mag& a, const Mag& b)
+{
+    Mag r(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t t = int64_t(a[i]) - (i < b.size() ? b[i] : 0) - borrow;
+        borrow = t < 0;
+        r[i] = uint32_t(t);
+    }
+    trim(r);
+    return r;
+}
+
+// r += x * 2^(32 * shift)
+void add_shifted (Mag& r, const Mag& x, size_t shift)
+{
+    if (r.size() < x.size() + shift)
+        r.resize(x.size() + shift, 0);
+    r.push_back(0);
+
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < x.size(); i++) {
+        carry += uint64_t(r[i + shift]) + x[i];
+        r[i + shift] = uint32_t(carry);
+        carry >>= 32;
+    }
+    for (i += shift; carry != 0; i++) {
+        carry += r[i];
+        r[i] = uint32_t(carry);
+        carry >>= 32;
+    }
+    trim(r);
+}
+
+Mag mul_school (const Mag& a, const Mag& b)
+{
+    Mag r(a.size() + b.size(), 0);
+    for (size_t i = 0; i < a.size(); i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b.size(); j++) {
+            carry += uint64_t(a[i]) * b[j] + r[i + j];
+            r[i + j] = uint32_t(carry);
+            carry >>= 32;
+        }
+        r[i + b.size()] = uint32_t(carry);
+    }
+    trim(r);
+    return r;
+}
+
+Mag mul_mag (const Mag& a, const Mag& b)
+{
+    if (a.size() < b.size())
+        return mul_mag(b, a);
+    if (b.empty())
+        return Mag();
+    if (b.size() < KaratsubaThreshold)
+        return mul_school(a, b);
+
+    /* lopsided: multiply by each b-sized piece of a */
+    if (2 * b.size() <= a.size()) {
+        Mag r;
+        for (size_t i = 0; i < a.size(); i += b.size()) {
+            Mag piece(a.begin() + i,
+                      a.begin() + std::min(i + b.size(), a.size()));
+            trim(piece);
+            add_shifted(r, mul_mag(piece, b), i);
+        }
+        return r;
+    }
+
+    /* karatsuba: with a = a1 B + a0 and b = b1 B + b0,
+       a b = z2 B^2 + z1 B + z0, where
+       z1 = (a0 + a1)(b0 + b1) - z2 - z0 */
+    size_t m = a.size() / 2;
+    Mag a0(a.begin(), a.begin() + m), a1(a.begin() + m, a.end());
+    Mag b0(b.begin(), b.begin() + m), b1(b.begin() + m, b.end());
+    trim(a0);
+    trim(b0);
+
+    Mag z0 = mul_mag(a0, b0);
+    Mag z2 = mul_mag(a1, b1);
+    Mag z1 = mul_mag(add_mag(a0, a1), add_mag(b0, b1));
+    z1 = sub_mag(sub_mag(z1, z0), z2);
+
+    Mag r = std::move(z0);
+    add_shifted(r, z1, m);
+    add_shifted(r, z2, 2 * m);
+    return r;
+}
+
+// returns the remainder
+uint32_t divmod_small (const Mag& u, uint32_t v, Mag& q)
+{
+    q.assign(u.size(), 0);
+    uint64_t rem = 0;
+    for (size_t i = u.size(); i-- > 0; ) {
+        uint64_t num = (rem << 32) | u[i];
+        q[i] = uint32_t(num / v);
+        rem = num % v;
+    }
+    trim(q);
+    return uint32_t(rem);
+}
+
+/* knuth's algorithm D, as in hacker's delight. v must be nonzero */
+void divmod_mag (const Mag& u, const Mag& v, Mag& q, Mag& r)
+{
+    if (cmp_mag(u, v) < 0) {
+        q.clear();
+        r = u;
+        return;
+    }
+    if (v.size() == 1) {
+        uint32_t rem = divmod_small(u, v[0], q);
+        r.assign(1, rem);
+        trim(r);
+        return;
+    }
+
+    const size_t m = u.size(), n = v.size();
+    const uint64_t b = uint64_t(1) << 32;
+
+    /* normalize so the top bit of v is set */
+    int s = __builtin_clz(v[n - 1]);
+    Mag vn(n), un(m + 1);
+    for (size_t i = n - 1; i > 0; i--)
+        vn[i] = (v[i] << s) | (s ? uint32_t(uint64_t(v[i - 1]) >> (32 - s)) : 0);
+    vn[0] = v[0] << s;
+    un[m] = s ? uint32_t(uint64_t(u[m - 1]) >> (32 - s)) : 0;
+    for (size_t i = m - 1; i > 0; i--)
+        un[i] = (u[i] << s) | (s ? uint32_t(uint64_t(u[i - 1]) >> (32 - s)) : 0);
+    un[0] = u[0] << s;
+
+    q.assign(m - n + 1, 0);
+    for (size_t j = m - n + 1; j-- > 0; ) {
+        uint64_t num = (uint64_t(un[j + n]) << 32) | un[j + n - 1];
+        uint64_t qhat = num / vn[n - 1];
+        uint64_t rhat = num % vn[n - 1];
+        while (qhat >= b
+               || qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= b)
+                break;
+        }
+
+        /* multiply and subtract */
+        int64_t k = 0, t;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t p = qhat * vn[i];
+            t = int64_t(un[i + j]) - k - int64_t(p & 0xffffffff);
+            un[i + j] = uint32_t(t);
+            k = int64_t(p >> 32) - (t >> 32);
+        }
+        t = int64_t(un[j + n]) - k;
+        un[j + n] = uint32_t(t);
+
+        /* subtracted too much, add back */
+        q[j] = uint32_t(qhat);
+        if (t < 0) {
+            q[j]--;
+            uint64_t carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                carry += uint64_t(un[i + j]) + vn[i];
+                un[i + j] = uint32_t(carry);
+                carry >>= 32;
+            }
+            un[j + n] += uint32_t(carry);
+        }
+    }
+    trim(q);
+
+    /* unnormalize the remainder */
+    r.assign(n, 0);
+    for (size_t i = 0; i < n; i++)
+        r[i] = (un[i] >> s) | (s ? uint32_t(uint64_t(un[i + 1]) << (32 - s)) : 0);
+    trim(r);
+}
+
+Cell add_signed (GC& gc, Int a, Int b)
+{
+    if (a.negative == b.negative) {
+        auto mag = add_mag(a.mag, b.mag);
+        return pack(gc, a.negative, mag);
+    }
+    if (cmp_mag(a.mag, b.mag) >= 0) {
+        auto mag = sub_mag(a.mag, b.mag);
+        return pack(gc, a.negative, mag);
+    }
+    else {
+        auto mag = sub_mag(b.mag, a.mag);
+        return pack(gc, b.negative, mag);
+    }
+}
+
+}
+
+
+Cell add (GC& gc, Cell a, Cell b)
+{
+    if (!is_integral(a) || !is_integral(b))
+        return Cell::nil();
+    return add_signed(gc, unpack(a), unpack(b));
+}
+
+Cell sub (GC& gc, Cell a, Cell b)
+{
+    if (!is_integral(a) || !is_integral(b))
+        return Cell::nil();
+    auto neg_b = unpack(b);
+    neg_b.negative = !neg_b.negative;
+    return add_signed(gc, unpack(a), std::move(neg_b));
+}
+
+Cell mul (GC& gc, Cell a, Cell b)
+{
+    if (!is_integral(a) || !is_integral(b))
+        return Cell::nil();
+
+    Fixnum fx;
+    if (a.is_integer() && b.is_integer()
+        && !__builtin_mul_overflow(a.integer(), b.integer(), &fx)
+        && FixnumMin <= fx && fx <= FixnumMax)
+        return Cell::from_fixnum(fx);
+
+    auto x = unpack(a), y = unpack(b);
+    auto mag = mul_mag(x.mag, y.mag);
+    return pack(gc, x.negative != y.negative, mag);
+}
+
+Cell div (GC& gc, Cell a, Cell b)
+{
+    if (!is_integral(a) || !is_integral(b))
+        return Cell::nil();
+
+    /* truncating, like the general case. only FixnumMin / -1 leaves
+       the range of fixnums */
+    if (a.is_integer() && b.is_integer()) {
+        auto x = a.integer(), y = b.integer();
+        if (y == 0)
+            throw std::runtime_error("division by zero");
+        if (x != FixnumMin || y != -1)
+            return Cell::from_fixnum(x / y);
+    }
+
+    auto x = unpack(a), y = unpack(b);
+    if (y.mag.empty())
+        throw std::runtime_error("division by zero");
+
+    Mag q, r;
+    divmod_mag(x.mag, y.mag, q, r);
+    return pack(gc, x.negative != y.negative, q);
+}
+
+int compare (Cell a, Cell b)
+{
+    if (a.is_integer() && b.is_integer()) {
+        auto x = a.integer(), y = b.integer();
+        return x < y ? -1 : (x > y ? 1 : 0);
+    }
+
+    /* a bignum is larger in magnitude than any fixnum */
+    auto x = unpack(a), y = unpack(b);
+    bool x_neg = x.negative && !x.mag.empty();
+    bool y_neg = y.negative && !y.mag.empty();
+    if (x_neg != y_neg)
+        return x_neg ? -1 : 1;
+    int c = cmp_mag(x.mag, y.mag);
+    return x_neg ? -c : c;
+}
+
+double to_double (Cell x)
+{
+    if (x.is_integer())
+        return double(x.integer());
+
+    auto& desc = *x.obj->data_as_bignum();
+    double d = 0;
+    for (size_t i = desc.count; i-- > 0; )
+        d = d * 4294967296.0 + desc.limbs[i];
+    return desc.negative ? -d : d;
+}
+
+bool to_int64 (Cell x, int64_t& out)
+{
+    if (x.is_integer()) {
+        out = x.integer();
+        return true;
+    }
+    if (!is_integral(x))
+        return false;
+
+    auto n = unpack(x);
+    if (n.mag.size() > 2)
+        return false;
+    uint64_t u = 0;
+    if (n.mag.size() > 0) u |= n.mag[0];
+    if (n.mag.size() > 1) u |= uint64_t(n.mag[1]) << 32;
+    if (!n.negative && u <= uint64_t(INT64_MAX))
+        out = int64_t(u);
+    else if (n.negative && u - 1 <= uint64_t(INT64_MAX))
+        out = -int64_t(u - 1) - 1;
+    else
+        return false;
+    return true;
+}
+
+Cell from_int128 (GC& gc, __int128 x)
+{
+    if (FixnumMin <= x && x <= FixnumMax)
+        return Cell::from_fixnum(Fixnum(x));
+
+    bool negative = x < 0;
+    unsigned __int128 u = negative ? -(unsigned __int128)(x) : x;
+    Mag mag;
+    for (; u != 0; u >>= 32)
+        mag.push_back(uint32_t(u));
+    return pack(gc, negative, mag);
+}
+
+std::string to_string (Cell x)
+{
+    auto n = unpack(x);
+    if (n.mag.empty())
+        return "0";
+
+    /* peel off 9 decimal digits at a time */
+    std::string digits;
+    Mag q;
+    while (!n.mag.empty()) {
+        uint32_t chunk = divmod_small(n.mag, 1000000000, q);
+        n.mag.swap(q);
+        for (int i = 0; i < 9; i++) {
+            digits.push_back(char('0' + chunk % 10));
+            chunk /= 10;
+            if (n.mag.empty() && chunk == 0)
+                break;
+        }
+    }
+    if (n.negative)
+        digits.push_back('-');
+    std::reverse(digits.begin(), digits.end());
+    return digits;
+}
+
+Cell from_digits (GC& gc, const std::string& digits)
+{
+    Mag mag;
+    for (size_t i = 0; i < digits.size(); ) {
+        /* fold in up to 9 digits at a time */
+        uint32_t chunk = 0, scale = 1;
+        for (size_t k = 0; k < 9 && i < digits.size(); k++, i++) {
+            chunk = chunk * 10 + uint32_t(digits[i] - '0');
+            scale *= 10;
+        }
+
+        uint64_t carry = chunk;
+        for (auto& limb : mag) {
+            carry += uint64_t(limb) * scale;
+            limb = uint32_t(carry);
+            carry >>= 32;
+        }
+        if (carry != 0)
+            mag.push_back(uint32_t(carry));
+    }
+    return pack(gc, false, mag);
+}
+
+}
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include "Cell.h"
+#include <string>
+
+namespace run {
+
+struct GC;
+
+/* arithmetic on integers, which are either fixnums or bignums.
+   results that fit in a fixnum are always returned as one, so a
+   bignum is never equal to any fixnum. callers are expected to try
+   the fixnum fast path themselves first; these are the slow paths. */
+namespace bignum {
+
+// true for fixnums and bignums
+inline bool is_integral (Cell x)
+{
+    return x.is_integer() || (x.is_object() && x.is_bignum());
+}
+
+Cell add (GC& gc, Cell a, Cell b);
+Cell sub (GC& gc, Cell a, Cell b);
+Cell mul (GC& gc, Cell a, Cell b);
+// truncating division; throws on division by zero
+Cell div (GC& gc, Cell a, Cell b);
+
+// -1, 0 or 1
+int compare (Cell a, Cell b);
+
+double to_double (Cell x);
+// false if `x' is not an integer in the range of int64_t
+bool to_int64 (Cell x, int64_t& out);
+Cell from_int128 (GC& gc, __int128 x);
+std::string to_string (Cell x);
+// a (possibly huge) string of decimal digits, e.g. from a literal
+Cell from_digits (GC& gc, const std::string& digits);
+
+}
+}
@@ -1,26 +1,38 @@
 #include "Cell.h"
+#include <new>
 
 namespace run {
 
 Cell Cell::null_object = nullptr;
-Cell Cell::true_object = nullptr;
-Cell Cell::false_object = nullptr;
+Cell Cell::true_object = Cell::from_bool(true);
+Cell Cell::false_object = Cell::from_bool(false);
+
+Object* Cell::datatypes[Cell::MaxDatatypes];
+std::atomic<size_t> Cell::datatype_count(1);
 
 Cell Cell::int_type = nullptr;
 Cell Cell::bool_type = nullptr;
+Cell Cell::float_type = nullptr;
 Cell Cell::string_type = nullptr;
 Cell Cell::array_type = nullptr;
+Cell Cell::vector_type = nullptr;
+Cell Cell::table_type = nullptr;
+Cell Cell::bytes_type = nullptr;
+Cell Cell::int32s_type = nullptr;
+Cell Cell::int64s_type = nullptr;
 Cell Cell::type_type = nullptr;
 
 namespace {
 struct CellSingetonInitialize
 {
-    static inline Cell static_alloc (uint8_t type, uint16_t size = 0)
+    static inline Cell static_alloc (uint8_t type, uint32_t size = 0)
     {
         Object* obj = (Object*)
             new char[sizeof(Object) + size];
 
         obj->type = type | Object::Static;
+        obj->gc_status = 0;
+        obj->shape = 0;
         obj->size = size;
 
         return Cell(obj);
@@ -28,19 +40,47 @@ struct CellSingetonInitialize
 
     CellSingetonInitialize ()
     {
-        Cell::true_object  = static_alloc(Object::True);
-        Cell::false_object = static_alloc(Object::False);
         Cell::type_type   = static_alloc(Object::Datatype | Object::DatatypeNoInst);
         Cell::int_type    = static_alloc(Object::Datatype | Object::DatatypeNoInst);
         Cell::bool_type   = static_alloc(Object::Datatype | Object::DatatypeNoInst);
+        Cell::float_type  = static_alloc(Object::Datatype | Object::DatatypeNoInst);
         Cell::string_type = static_alloc(Object::Datatype | Object::DatatypeNoInst);
         Cell::array_type  = static_alloc(Object::Datatype | Object::DatatypeNoInst);
+        Cell::vector_type = static_alloc(Object::Datatype | Object::DatatypeNoInst);
+        Cell::table_type  = static_alloc(Object::Datatype | Object::DatatypeNoInst);
+        Cell::bytes_type  = static_alloc(Object::Datatype | Object::DatatypeNoInst);
+        Cell::int32s_type = static_alloc(Object::Datatype | Object::DatatypeNoInst);
+        Cell::int64s_type = static_alloc(Object::Datatype | Object::DatatypeNoInst);
     }
 };
 // slight hack to call constructor before main()
 CellSingetonInitialize _;
 }
 
+Payload* Payload::make (size_t size)
+{
+    auto p = reinterpret_cast<Payload*>(new char[sizeof(Payload) + size]);
+    new (&p->refs) std::atomic<size_t>(1);
+    p->size = size;
+    return p;
+}
+
+void Payload::release ()
+{
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete[] reinterpret_cast<char*>(this);
+}
+
+const char* kind_name (unsigned kind)
+{
+    static const char* names[Object::TypeMask + 1] = {
+        "instance", "array", "vector", "table", "string", "datatype",
+        "float", "bignum", "bytes", "int32s", "int64s",
+    };
+    auto name = names[kind & Object::TypeMask];
+    return name ? name : "unknown";
+}
+
 Cell Cell::get_type () const
 {
     if (is_null())
@@ -49,23 +89,49 @@ Cell Cell::get_type () const
     if (is_integer())
         return int_type;
 
-    switch (obj->type & ~(Object::Static | Object::DatatypeNoInst)) {
+    if (is_small_string())
+        return string_type;
+
+    if (is_immediate_float())
+        return float_type;
+
+    if (is_bool())
+        return bool_type;
+
+    switch (obj->kind()) {
     case Object::Array:
         return array_type;
 
-    case Object::True:
-    case Object::False:
-        return bool_type;
+    case Object::Vector:
+        return vector_type;
+
+    case Object::Table:
+        return table_type;
 
     case Object::String:
         return string_type;
 
+    case Object::Bytes:
+        return bytes_type;
+
+    case Object::Int32s:
+        return int32s_type;
+
+    case Object::Int64s:
+        return int64s_type;
+
+    case Object::Float:
+        return float_type;
+
+    case Object::Bignum:
+        return int_type;
+
     case Object::Datatype:
         return type_type;
 
     case Object::Instance:
     default:
-        return children()[0];
+        return datatypes[obj->shape];
     }
 }
 
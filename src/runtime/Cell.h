@@ -2,6 +2,9 @@
 #include "../datatypes.h"
 #include <boost/utility/string_ref.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <atomic>
+#include <cstring>
+#include <vector>
 
 namespace run {
 
@@ -10,42 +13,107 @@ data forms:
   - null
   - boolean
   - integer
+  - float
   - string
   - array
+  - vector
+  - table
+  - packed arrays (bytes, int32s, int64s)
   - datatype
   - instance
  */
 
 struct Cell;
 
+/* the contents of a large string or packed array, kept out of line so
+   that they can be handed from one State to another without copying
+   (see Channel). strings never change, so their payloads may be shared
+   by several objects, even in different States; a packed array's
+   payload is only shared while it is being transferred. freed along
+   with the last reference */
+struct Payload
+{
+    std::atomic<size_t> refs;
+    size_t size;
+    char bytes[0];
+
+    // with one reference, and `size' bytes left uninitialised
+    static Payload* make (size_t size);
+
+    inline void retain ()
+    { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release ();
+};
+
 struct Object
 {
 	enum {
-        TypeMask =  0x1f,
+        TypeMask =  0x0f,
 
-        // flags for discerning type:
+        // kinds, found by masking with TypeMask:
 		Instance =  0x00,
 		Array =     0x01,
-		Bool =      0x06,  True = 0x02, False = 0x04,
-		String =    0x08,
-		Datatype =  0x10,
+        Vector =    0x02, // children: items array, length
+        Table =     0x03, // children: keys array, values array, count
+		String =    0x04,
+		Datatype =  0x05,
+        Float =     0x06, // only floats that can't be immediate
+        Bignum =    0x07, // only integers that don't fit a fixnum
+        // packed arrays: raw elements, no cells, so the GC never looks inside
+        Bytes =     0x08,
+        Int32s =    0x09,
+        Int64s =    0x0a,
 
         // additional flags:
+        // strings and packed arrays: contents in a Payload, see ExternalDesc
+        External = 0x10,
         DatatypeNoInst = 0x20,
+        StringSlice = 0x20,
+        Interned = 0x40,
 		Static = 0x80,
 	};
 
 	uint8_t type;
     uint8_t gc_status;
-	uint16_t size;
+    // for instances, the id of their datatype, see Cell::datatypes.
+    // datatypes hold their own id. zero for everything else
+    uint16_t shape;
+    // bytes of data. 32 bits, so that string buffers can grow past
+    // 64 KiB, which also makes the header 8 bytes and keeps data aligned
+    uint32_t size;
 	char data[0];
 
+    inline unsigned kind () const
+    { return type & TypeMask; }
+
     struct DatatypeDesc
     {
         size_t count;
         boost::string_ref fields[0];
     };
 
+    /* strings built by GC::concat() are slices: a prefix of a
+       buffer that may be shared with other slices. the buffer
+       itself is a plain String object holding a StringBufferDesc,
+       and is never handed out as a value */
+    struct StringSliceDesc
+    {
+        Object* buffer;
+        size_t length;
+    };
+    struct StringBufferDesc
+    {
+        // characters below `used' are never modified again
+        size_t used;
+        char chars[0];
+    };
+
+    struct ExternalDesc
+    {
+        // null once a packed array's contents have been moved away
+        Payload* payload;
+    };
+
     inline Cell* data_as_cells () const
     {
         return (Cell*) data;
@@ -54,8 +122,70 @@ struct Object
     {
         return (DatatypeDesc*) data;
     }
+    inline StringSliceDesc* data_as_string_slice () const
+    {
+        return (StringSliceDesc*) data;
+    }
+    inline StringBufferDesc* data_as_string_buffer () const
+    {
+        return (StringBufferDesc*) data;
+    }
+    struct BignumDesc
+    {
+        bool negative;
+        uint32_t count;
+        // magnitude, least significant limb first
+        uint32_t limbs[0];
+    };
+
+    inline BignumDesc* data_as_bignum () const
+    {
+        return (BignumDesc*) data;
+    }
+    inline double* data_as_float () const
+    {
+        return (double*) data;
+    }
+    inline ExternalDesc* data_as_external () const
+    {
+        return (ExternalDesc*) data;
+    }
+
+    // the elements of a packed array, or the characters (and a
+    // terminator) of a string that isn't a slice, wherever they are
+    inline char* contents () const
+    {
+        if (!(type & External))
+            return (char*) data;
+        auto payload = data_as_external()->payload;
+        return payload ? payload->bytes : nullptr;
+    }
+    inline size_t contents_size () const
+    {
+        if (!(type & External))
+            return size;
+        auto payload = data_as_external()->payload;
+        return payload ? payload->size : 0;
+    }
+
+    static inline size_t packed_elem_size (unsigned kind)
+    {
+        switch (kind) {
+        case Int32s: return sizeof(int32_t);
+        case Int64s: return sizeof(int64_t);
+        default:     return 1;
+        }
+    }
+    inline size_t packed_elem_size () const
+    {
+        return packed_elem_size(kind());
+    }
 };
 
+// "instance", "array" and so on, for messages; `kind' is masked by
+// Object::TypeMask
+const char* kind_name (unsigned kind);
+
 struct Cell
 {
 	inline constexpr Cell (Object* o = nullptr)
@@ -65,24 +195,65 @@ struct Cell
 	Object* obj;
 
 
+    /* representation, by the low bits of `obj':
+         ...xx1  integer
+         ...000  object pointer, or null
+         ...010  small string; length in bits 3-5, and up to
+                 SmallStringMax characters in the upper bytes
+         ...100  float; see immediate_float()
+         ...110  boolean; false is 0x06 and true is 0x0e */
+    enum {
+        TagMask = 0x7,
+        SmallStringTag = 0x2,
+        SmallStringMax = sizeof(Object*) - 1,
+        FloatTag = 0x4,
+        BoolTag = 0x6,
+        FalseBits = BoolTag,
+        TrueBits = (1 << 3) | BoolTag,
+    };
+
+
 	/* predicates */
 
 	// what kind of representation?
 	inline bool is_integer () const { return uintptr_t(obj) & 1; }
 	inline bool is_null () const { return obj == nullptr; }
-	inline bool is_object () const { return !is_null() && !is_integer(); }
+	inline bool is_object () const { return !is_null() && (uintptr_t(obj) & TagMask) == 0; }
+    inline bool is_small_string () const
+    { return (uintptr_t(obj) & TagMask) == SmallStringTag; }
+
+    inline bool is_immediate_float () const
+    { return (uintptr_t(obj) & TagMask) == FloatTag; }
+    inline bool is_bool () const
+    { return (uintptr_t(obj) & TagMask) == BoolTag; }
+    inline bool is_false () const
+    { return uintptr_t(obj) == FalseBits; }
+
+    // strings and floats may be immediate or objects, so these can be
+    // called on anything
+    inline bool is_string () const
+    { return is_small_string() || (is_object() && obj->kind() == Object::String); }
+    inline bool is_float () const
+    { return is_immediate_float() || (is_object() && obj->kind() == Object::Float); }
 
 	// what kind of object, assuming is_object() has already been checked
-	inline bool is_string () const    { return obj->type & Object::String; }
-	inline bool is_bool () const      { return obj->type & Object::Bool; }
-	inline bool is_datatype () const  { return obj->type & Object::Datatype; }
-	inline bool is_array () const     { return obj->type & Object::Array; }
+    inline bool is_string_slice () const
+    { return obj->kind() == Object::String && (obj->type & Object::StringSlice); }
+    inline bool is_interned () const
+    { return obj->kind() == Object::String && (obj->type & Object::Interned); }
+	inline bool is_datatype () const  { return obj->kind() == Object::Datatype; }
+	inline bool is_bignum () const    { return obj->kind() == Object::Bignum; }
+	inline bool is_array () const     { return obj->kind() == Object::Array; }
 	inline bool is_static () const    { return obj->type & Object::Static; }
-	inline bool is_instance () const  { return (obj->type & Object::TypeMask) == 0x00; }
-	inline bool has_children () const { return (obj->type & Object::TypeMask) <= 0x1; }
+	inline bool is_instance () const  { return obj->kind() == Object::Instance; }
+	inline bool is_vector () const    { return obj->kind() == Object::Vector; }
+	inline bool is_table () const     { return obj->kind() == Object::Table; }
+	inline bool has_children () const { return obj->kind() <= Object::Table; }
+    inline bool is_packed () const
+    { return obj->kind() >= Object::Bytes && obj->kind() <= Object::Int64s; }
     inline bool can_make_instances () const
     {
-        return (obj->type & Object::Datatype)
+        return obj->kind() == Object::Datatype
             && !(obj->type & Object::DatatypeNoInst);
     }
 
@@ -94,16 +265,43 @@ struct Cell
 		return intptr_t(obj) >> 1;
 	}
 
-	// when is_string() is true
-	inline boost::string_ref string () const
+    // when is_float() is true
+    inline double floating () const
+    {
+        if (!is_immediate_float())
+            return *obj->data_as_float();
+
+        uint64_t rot = uintptr_t(obj) >> 3;
+        if (rot > 1)
+            rot += FloatExponentOffset;
+        uint64_t bits = (rot >> 1) | (rot << 63);
+        double d;
+        std::memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+	// when is_string() is true. the characters of a small string live in
+	// the cell itself, so the result is only valid as long as this Cell
+	// is, and can't be taken from a temporary
+	inline boost::string_ref string () const &
 	{
-		return boost::string_ref(obj->data, obj->size);
+        if (is_small_string()) {
+            auto len = (uintptr_t(obj) >> 3) & TagMask;
+            return boost::string_ref(reinterpret_cast<const char*>(&obj) + 1, len);
+        }
+        if (is_string_slice()) {
+            auto slice = obj->data_as_string_slice();
+            auto buf = slice->buffer->data_as_string_buffer();
+            return boost::string_ref(buf->chars, slice->length);
+        }
+		return boost::string_ref(obj->contents(), obj->contents_size() - 1);
 	}
+    boost::string_ref string () const && = delete;
 
     // whenever
     inline bool boolean () const
     {
-        return obj != false_object.obj;
+        return !is_false();
     }
 
 	// when is_object() and has_children() are both true
@@ -115,6 +313,12 @@ struct Cell
 							obj->data_as_cells() + size);
 	}
 
+    // when is_packed(); the number of elements
+    inline size_t packed_length () const
+    {
+        return obj->contents_size() / obj->packed_elem_size();
+    }
+
     // when is_datatype() and can_make_instances()
     using DatatypeFields = boost::iterator_range<boost::string_ref*>;
     inline DatatypeFields fields () const
@@ -124,6 +328,19 @@ struct Cell
                               desc->fields + desc->count);
     }
 
+    // when both are strings. constant time if both are interned; strings
+    // short enough to be small are never stored as objects
+    inline bool string_equals (Cell other) const
+    {
+        if (obj == other.obj)
+            return true;
+        if (is_small_string() || other.is_small_string())
+            return false;
+        if (is_interned() && other.is_interned())
+            return false;
+        return string() == other.string();
+    }
+
     // can be called for any object, returns a datatype object
     // or returns null (the type of null is null)
     Cell get_type () const;
@@ -134,11 +351,28 @@ struct Cell
 	static Cell true_object;
 	static Cell false_object;
 
+    /* datatypes made by GC::make_datatype(), indexed by id, so that an
+       instance names its datatype with the 16-bit Object::shape rather
+       than a whole cell. they are never collected. slot 0 is unused.
+       the table is shared by every State: ids are handed out
+       atomically and slots are never moved, so a State may read the
+       slot of any datatype it has a reference to */
+    enum { MaxDatatypes = UINT16_MAX + 1 };
+    static Object* datatypes[MaxDatatypes];
+    // ids handed out so far, including slot 0
+    static std::atomic<size_t> datatype_count;
+
 	// universal datatypes
 	static Cell int_type;
 	static Cell bool_type;
+	static Cell float_type;
 	static Cell string_type;
 	static Cell array_type;
+	static Cell vector_type;
+	static Cell table_type;
+	static Cell bytes_type;
+	static Cell int32s_type;
+	static Cell int64s_type;
 	static Cell type_type;
 
 
@@ -147,10 +381,45 @@ struct Cell
     inline static Cell nil ()
     { return Cell(); }
 
+    inline static Cell from_bool (bool b)
+    { return Cell((Object*) (b ? uintptr_t(TrueBits) : uintptr_t(FalseBits))); }
+
 	inline static Cell from_fixnum (Fixnum fx)
 	{
 		return Cell((Object*) ((uintptr_t(fx) << 1) | 1));
 	}
+
+    /* immediate floats keep the full 52-bit mantissa, but only an
+       8-bit exponent: the sign bit is rotated to the bottom, the
+       exponent rebased by FloatExponentOffset, and the result shifted
+       over the tag. this covers zero and magnitudes from about 1e-38
+       to 3e38; anything else (including inf and nan) has to be boxed,
+       see GC::make_float(). returns false if `d' can't be immediate */
+    static const uint64_t FloatExponentOffset = uint64_t(896) << 53;
+
+    inline static bool immediate_float (double d, Cell& out)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        uint64_t rot = (bits << 1) | (bits >> 63);
+        if (rot > 1) {
+            uint64_t exponent = (bits >> 52) & 0x7ff;
+            if (exponent <= 896 || exponent >= 896 + 256)
+                return false;
+            rot -= FloatExponentOffset;
+        }
+        out = Cell((Object*) ((rot << 3) | FloatTag));
+        return true;
+    }
+
+    // requires s.size() <= SmallStringMax. (assumes little endian, so
+    // the tag byte comes first in memory)
+    inline static Cell small_string (boost::string_ref s)
+    {
+        uintptr_t bits = (s.size() << 3) | SmallStringTag;
+        std::memcpy(reinterpret_cast<char*>(&bits) + 1, s.data(), s.size());
+        return Cell((Object*) bits);
+    }
 };
 
 
@@ -0,0 +1,275 @@
+#include "Channel.h"
+#include "Collections.h"
+#include "GC.h"
+#include "State.h"
+#include <cstring>
+#include <unordered_map>
+
+namespace run {
+
+/*** Packing ***/
+
+namespace {
+
+/* copies a graph of objects out of a heap. breadth first rather than
+   recursive, so that long lists can't overflow the stack */
+struct Packer
+{
+    explicit Packer (bool transfer)
+        : transfer(transfer), bytes_copied(0), bytes_shared(0)
+    {}
+    // whatever wasn't handed over to a message
+    ~Packer ()
+    {
+        for (auto obj : objects)
+            GC::free_detached(obj);
+    }
+
+    bool transfer;
+    std::unordered_map<Object*, Object*> copies;
+    std::vector<Object*> objects;
+    // copies whose children still refer to the original heap
+    std::vector<Object*> pending;
+    // copies of tables, which need rehashing once their keys are copied
+    std::vector<Object*> tables;
+    // packed arrays whose payloads are being transferred. the copy
+    // holds a reference of its own until packing has succeeded, when
+    // the original gives up its one
+    std::vector<Object*> moved;
+    size_t bytes_copied, bytes_shared;
+
+    Cell copy (Cell x);
+    void finish ();
+
+private:
+    Object* copy_external_ (Object* obj);
+};
+
+Cell Packer::copy (Cell x)
+{
+    if (!x.is_object() || x.is_datatype())
+        return x;
+    auto it = copies.find(x.obj);
+    if (it != copies.end())
+        return Cell(it->second);
+
+    auto obj = x.obj;
+    Object* dup;
+    if (x.is_string_slice()) {
+        // only the characters in use, not the whole buffer
+        dup = GC::detached_string(x.string());
+        if (dup->type & Object::External)
+            bytes_copied += dup->contents_size();
+    }
+    else if (obj->type & Object::External) {
+        dup = copy_external_(obj);
+    }
+    else {
+        dup = GC::alloc_detached(obj->type & ~(Object::Interned | Object::Static), obj->size);
+        dup->shape = obj->shape;
+        std::memcpy(dup->data, obj->data, obj->size);
+    }
+    bytes_copied += sizeof(Object) + dup->size;
+
+    copies.emplace(obj, dup);
+    objects.push_back(dup);
+    if (Cell(dup).has_children())
+        pending.push_back(dup);
+    if (dup->kind() == Object::Table)
+        tables.push_back(dup);
+    return Cell(dup);
+}
+
+Object* Packer::copy_external_ (Object* obj)
+{
+    auto dup = GC::alloc_detached(obj->type & ~(Object::Interned | Object::Static),
+                                  sizeof(Object::ExternalDesc));
+    auto payload = obj->data_as_external()->payload;
+    if (payload) {
+        if (obj->kind() == Object::String) {
+            payload->retain();
+            bytes_shared += payload->size;
+        }
+        else if (transfer) {
+            payload->retain();
+            moved.push_back(obj);
+            bytes_shared += payload->size;
+        }
+        else {
+            auto copy = Payload::make(payload->size);
+            std::memcpy(copy->bytes, payload->bytes, payload->size);
+            payload = copy;
+            bytes_copied += payload->size;
+        }
+    }
+    dup->data_as_external()->payload = payload;
+    return dup;
+}
+
+void Packer::finish ()
+{
+    while (!pending.empty()) {
+        auto obj = pending.back();
+        pending.pop_back();
+        for (auto& child : Cell(obj).children())
+            child = copy(child);
+    }
+    for (auto obj : tables)
+        table_rehash(Cell(obj));
+    for (auto obj : moved) {
+        auto& payload = obj->data_as_external()->payload;
+        payload->release();
+        payload = nullptr;
+    }
+}
+
+}
+
+Message::Message ()
+    : bytes_copied(0)
+    , bytes_shared(0)
+    , root_(Cell::nil())
+{}
+
+Message::Message (Message&& other)
+    : bytes_copied(other.bytes_copied)
+    , bytes_shared(other.bytes_shared)
+    , root_(other.root_)
+    , objects_(std::move(other.objects_))
+{
+    other.objects_.clear();
+    other.root_ = Cell::nil();
+}
+
+Message& Message::operator= (Message&& other)
+{
+    if (this != &other) {
+        free_();
+        bytes_copied = other.bytes_copied;
+        bytes_shared = other.bytes_shared;
+        root_ = other.root_;
+        objects_.swap(other.objects_);
+        other.root_ = Cell::nil();
+    }
+    return *this;
+}
+
+Message::~Message ()
+{
+    free_();
+}
+
+void Message::free_ ()
+{
+    for (auto obj : objects_)
+        GC::free_detached(obj);
+    objects_.clear();
+}
+
+Message Message::pack (Cell x, bool transfer)
+{
+    Packer packer(transfer);
+    Message msg;
+    msg.root_ = packer.copy(x);
+    packer.finish();
+    msg.objects_.swap(packer.objects);
+    msg.bytes_copied = packer.bytes_copied;
+    msg.bytes_shared = packer.bytes_shared;
+    return msg;
+}
+
+Cell Message::unpack (State& to)
+{
+    to.gc.adopt(objects_);
+    objects_.clear();
+    auto x = root_;
+    root_ = Cell::nil();
+    return x;
+}
+
+
+
+/*** Channels ***/
+
+Channel::Channel (size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1))
+    , closed_(false)
+{}
+
+void Channel::send (Cell x, bool transfer)
+{
+    send(Message::pack(x, transfer));
+}
+
+void Channel::send (Message msg)
+{
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        not_full_.wait(guard, [this] { return closed_ || queue_.size() < capacity_; });
+        if (closed_)
+            throw std::runtime_error("send on a closed channel");
+
+        stats_.sent++;
+        stats_.bytes_copied += msg.bytes_copied;
+        stats_.bytes_shared += msg.bytes_shared;
+        queue_.push_back(std::move(msg));
+    }
+    not_empty_.notify_one();
+}
+
+bool Channel::receive (State& to, Cell& out)
+{
+    Message msg;
+    {
+        std::unique_lock<std::mutex> guard(lock_);
+        not_empty_.wait(guard, [this] { return closed_ || !queue_.empty(); });
+        if (queue_.empty())
+            return false;
+        msg = take_();
+    }
+    not_full_.notify_one();
+    out = msg.unpack(to);
+    return true;
+}
+
+bool Channel::try_receive (State& to, Cell& out)
+{
+    Message msg;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (queue_.empty())
+            return false;
+        msg = take_();
+    }
+    not_full_.notify_one();
+    out = msg.unpack(to);
+    return true;
+}
+
+Message Channel::take_ ()
+{
+    auto msg = std::move(queue_.front());
+    queue_.pop_front();
+    stats_.received++;
+    return msg;
+}
+
+void Channel::close ()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        closed_ = true;
+    }
+    not_empty_.notify_all();
+    not_full_.notify_all();
+}
+
+ChannelStats Channel::stats () const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    auto stats = stats_;
+    stats.queued = queue_.size();
+    return stats;
+}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "Cell.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace run {
+
+struct State;
+
+/* a value on its way from the heap of one State to another's. packing
+   copies the objects it refers to into a graph that belongs to no
+   heap (sharing included), except that
+
+    - datatypes are never copied, being shared by every State
+    - large strings share their Payload with the original, since
+      strings never change
+    - with `transfer', large packed arrays have their Payload moved
+      into the message, leaving the original empty
+
+   so that however big a value's buffers are, sending it only copies
+   the small objects around them. the receiving heap takes over the
+   objects as they are, without copying them again */
+struct Message
+{
+    Message ();
+    Message (Message&& other);
+    Message& operator= (Message&& other);
+    // frees the objects, unless unpacked
+    ~Message ();
+
+    // must be called on the thread using the State that `x' belongs to
+    static Message pack (Cell x, bool transfer = false);
+    // the value, in the heap of `to'. only once; like any new object
+    // it isn't rooted, so must be stored somewhere before allocating
+    Cell unpack (State& to);
+
+    // bytes of objects copied, and of payloads shared or moved
+    size_t bytes_copied;
+    size_t bytes_shared;
+
+private:
+    Cell root_;
+    std::vector<Object*> objects_;
+
+    void free_ ();
+};
+
+struct ChannelStats
+{
+    size_t sent = 0;
+    size_t received = 0;
+    size_t queued = 0;
+    size_t bytes_copied = 0;
+    size_t bytes_shared = 0;
+};
+
+/* a bounded queue of messages between States on different threads,
+   for any number of senders and receivers:
+
+     Channel ch(16);
+     // on one thread, with State a:
+     ch.send(x);   // waits while 16 are queued
+     ch.close();
+     // on another, with State b:
+     Cell y;
+     while (ch.receive(b, y)) ... */
+class Channel
+{
+public:
+    explicit Channel (size_t capacity = 64);
+    Channel (const Channel&) = delete;
+    Channel& operator= (const Channel&) = delete;
+
+    // waits for room. `x' is packed before waiting, see Message::pack().
+    // throws if the channel is closed
+    void send (Cell x, bool transfer = false);
+    void send (Message msg);
+
+    // waits for a message, unpacking it into `to'; false once the
+    // channel is closed and empty
+    bool receive (State& to, Cell& out);
+    // false if there's nothing queued
+    bool try_receive (State& to, Cell& out);
+
+    // wakes everyone waiting; messages already queued can still be
+    // received
+    void close ();
+
+    ChannelStats stats () const;
+
+private:
+    size_t capacity_;
+    mutable std::mutex lock_;
+    std::condition_variable not_empty_, not_full_;
+    std::deque<Message> queue_;
+    bool closed_;
+
+    // under lock_
+    ChannelStats stats_;
+
+    Message take_ ();
+};
+
+}
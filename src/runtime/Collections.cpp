@@ -0,0 +1,264 @@
+#include "Collections.h"
+#include "Bignum.h"
+#include "GC.h"
+#include <boost/format.hpp>
+
+namespace run {
+
+/*** Vectors ***/
+
+namespace {
+enum { VectorItems = 0, VectorLength = 1 };
+}
+
+size_t vector_length (Cell v)
+{
+    return size_t(v.children()[VectorLength].integer());
+}
+
+Cell& vector_at (Cell v, Fixnum i)
+{
+    auto len = Fixnum(vector_length(v));
+    if (i < 0 || i >= len) {
+        auto fmt = boost::format
+            ("index %d out of range for vector of length %d") % i % len;
+        throw std::runtime_error(fmt.str());
+    }
+    return v.children()[VectorItems].children()[i];
+}
+
+void vector_push (GC& gc, Cell v, Cell x)
+{
+    auto fields = v.children();
+    auto items = fields[VectorItems].children();
+    size_t len = vector_length(v);
+    gc.write_barrier(x);
+
+    /* out of room: move to an array twice the size */
+    if (len == items.size()) {
+        auto new_items = gc.make_array(std::max<size_t>(len * 2, 4));
+        std::copy(items.begin(), items.end(), new_items.children().begin());
+        gc.write_barrier(fields[VectorItems]); // as in table_grow()
+        fields[VectorItems] = new_items;
+        items = new_items.children();
+    }
+
+    items[len] = x;
+    fields[VectorLength] = Cell::from_fixnum(Fixnum(len + 1));
+}
+
+Cell vector_pop (Cell v)
+{
+    auto fields = v.children();
+    size_t len = vector_length(v);
+    if (len == 0)
+        throw std::runtime_error("pop from empty vector");
+
+    auto& slot = fields[VectorItems].children()[len - 1];
+    auto x = slot;
+    slot = Cell::nil();
+    fields[VectorLength] = Cell::from_fixnum(Fixnum(len - 1));
+    return x;
+}
+
+
+
+/*** Hashing ***/
+
+namespace {
+
+inline size_t mix (uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    return size_t(x);
+}
+
+inline size_t hash_bytes (const char* s, size_t len)
+{
+    /* FNV-1a */
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= uint8_t(s[i]);
+        h *= 0x100000001b3ULL;
+    }
+    return size_t(h);
+}
+
+}
+
+size_t hash_cell (Cell x)
+{
+    if (x.is_string()) {
+        auto s = x.string();
+        return hash_bytes(s.data(), s.size());
+    }
+    if (x.is_float()) {
+        double d = x.floating();
+        if (d == 0) d = 0; // -0 == 0
+        uint64_t bits;
+        std::memcpy(&bits, &d, sizeof(bits));
+        return mix(bits);
+    }
+    if (x.is_object() && x.is_bignum()) {
+        auto& desc = *x.obj->data_as_bignum();
+        return hash_bytes(reinterpret_cast<const char*>(desc.limbs),
+                          desc.count * sizeof(uint32_t)) ^ desc.negative;
+    }
+    return mix(uintptr_t(x.obj));
+}
+
+bool cells_equal (Cell a, Cell b)
+{
+    if (a.obj == b.obj)
+        return true;
+    if (a.is_string() && b.is_string())
+        return a.string_equals(b);
+    if (a.is_float() && b.is_float())
+        return a.floating() == b.floating();
+    if (a.is_object() && a.is_bignum() && b.is_object() && b.is_bignum())
+        return bignum::compare(a, b) == 0;
+    return false;
+}
+
+
+
+/*** Tables ***/
+
+namespace {
+
+enum { TableKeys = 0, TableValues = 1, TableCount = 2 };
+
+// finds the slot for `key': either where it is, or the empty slot
+// where it would be inserted
+size_t table_probe (Cell::CellChildren keys, Cell key)
+{
+    size_t mask = keys.size() - 1;
+    size_t i = hash_cell(key) & mask;
+    while (!keys[i].is_null() && !cells_equal(keys[i], key))
+        i = (i + 1) & mask;
+    return i;
+}
+
+void table_grow (GC& gc, Cell t)
+{
+    auto fields = t.children();
+    auto keys = fields[TableKeys].children();
+    auto values = fields[TableValues].children();
+
+    size_t capacity = keys.size() * 2;
+    auto new_keys = gc.make_array(capacity);
+    auto new_values = gc.make_array(capacity);
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (keys[i].is_null())
+            continue;
+        size_t j = table_probe(new_keys.children(), keys[i]);
+        new_keys.children()[j] = keys[i];
+        new_values.children()[j] = values[i];
+    }
+
+    /* the entries were copied into new (so already marked) arrays
+       without the write barrier; shading the old arrays instead is
+       enough for them all to be marked */
+    gc.write_barrier(fields[TableKeys]);
+    gc.write_barrier(fields[TableValues]);
+    fields[TableKeys] = new_keys;
+    fields[TableValues] = new_values;
+}
+
+}
+
+size_t table_count (Cell t)
+{
+    return size_t(t.children()[TableCount].integer());
+}
+
+bool table_get (Cell t, Cell key, Cell& value_out)
+{
+    if (key.is_null())
+        return false;
+
+    auto fields = t.children();
+    auto keys = fields[TableKeys].children();
+    size_t i = table_probe(keys, key);
+    if (keys[i].is_null())
+        return false;
+
+    value_out = fields[TableValues].children()[i];
+    return true;
+}
+
+void table_set (GC& gc, Cell t, Cell key, Cell value)
+{
+    if (key.is_null())
+        throw std::runtime_error("table keys may not be null");
+    gc.write_barrier(key);
+    gc.write_barrier(value);
+
+    /* keep the load factor under 3/4 */
+    size_t count = table_count(t);
+    if ((count + 1) * 4 > t.children()[TableKeys].children().size() * 3)
+        table_grow(gc, t);
+
+    auto fields = t.children();
+    auto keys = fields[TableKeys].children();
+    size_t i = table_probe(keys, key);
+    if (keys[i].is_null()) {
+        keys[i] = key;
+        fields[TableCount] = Cell::from_fixnum(Fixnum(count + 1));
+    }
+    fields[TableValues].children()[i] = value;
+}
+
+bool table_remove (Cell t, Cell key)
+{
+    if (key.is_null())
+        return false;
+
+    auto fields = t.children();
+    auto keys = fields[TableKeys].children();
+    auto values = fields[TableValues].children();
+    size_t mask = keys.size() - 1;
+    size_t i = table_probe(keys, key);
+    if (keys[i].is_null())
+        return false;
+
+    /* shift back any following entries that would no longer be
+       reachable across the hole, instead of leaving tombstones */
+    for (size_t j = (i + 1) & mask; !keys[j].is_null(); j = (j + 1) & mask) {
+        size_t home = hash_cell(keys[j]) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            keys[i] = keys[j];
+            values[i] = values[j];
+            i = j;
+        }
+    }
+    keys[i] = Cell::nil();
+    values[i] = Cell::nil();
+    fields[TableCount] = Cell::from_fixnum(Fixnum(table_count(t) - 1));
+    return true;
+}
+
+void table_rehash (Cell t)
+{
+    auto fields = t.children();
+    auto keys = fields[TableKeys].children();
+    auto values = fields[TableValues].children();
+
+    std::vector<std::pair<Cell, Cell>> entries;
+    entries.reserve(table_count(t));
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (!keys[i].is_null()) {
+            entries.emplace_back(keys[i], values[i]);
+            keys[i] = values[i] = Cell::nil();
+        }
+    }
+    for (auto& entry : entries) {
+        size_t i = table_probe(keys, entry.first);
+        keys[i] = entry.first;
+        values[i] = entry.second;
+    }
+}
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include "Cell.h"
+
+namespace run {
+
+struct GC;
+
+/* operations on the growable collection objects made by
+   GC::make_vector() and GC::make_table(). both keep their contents
+   in ordinary arrays, which are replaced by larger ones as they fill
+   up, so the collector needs no special knowledge of them. */
+
+// vectors
+size_t vector_length (Cell v);
+// throws if `i' is out of range. storing through the result needs
+// GC::write_barrier()
+Cell& vector_at (Cell v, Fixnum i);
+// amortised O(1)
+void vector_push (GC& gc, Cell v, Cell x);
+// throws if the vector is empty
+Cell vector_pop (Cell v);
+
+// hashing and equality for table keys: integers, floats and strings
+// compare by value, everything else by identity
+size_t hash_cell (Cell x);
+bool cells_equal (Cell a, Cell b);
+
+// tables, using open addressing with linear probing. keys may be
+// anything but null, which marks empty slots
+size_t table_count (Cell t);
+bool table_get (Cell t, Cell key, Cell& value_out);
+void table_set (GC& gc, Cell t, Cell key, Cell value);
+bool table_remove (Cell t, Cell key);
+// puts every entry back where it belongs. needed after the collector
+// moves objects, since most objects used as keys hash by address
+void table_rehash (Cell t);
+
+}
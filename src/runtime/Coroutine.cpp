@@ -0,0 +1,81 @@
+#include "Coroutine.h"
+#include "State.h"
+#include <algorithm>
+
+namespace run {
+
+Coroutine::Coroutine (State* st)
+    : state(st)
+    , status(Ready)
+    , top(0)
+    , acc(Cell::nil())
+    , result(Cell::nil())
+    , scheduled(false)
+    , suspending(false)
+    , return_on_resume(false)
+    , caller(nullptr)
+    , prev_(nullptr)
+    , next_(st->coroutines)
+{
+    if (next_)
+        next_->prev_ = this;
+    state->coroutines = this;
+}
+
+Coroutine::~Coroutine ()
+{
+    if (prev_)
+        prev_->next_ = next_;
+    else
+        state->coroutines = next_;
+    if (next_)
+        next_->prev_ = prev_;
+}
+
+bytecode::FieldCache* Coroutine::caches_for_ (const bytecode::Program* prog)
+{
+    return prog->field_sites.empty() ? nullptr : state->field_caches(*prog);
+}
+
+void Coroutine::grow_ (size_t n)
+{
+    if (n > regs.size())
+        regs.resize(std::max(n, 2 * regs.size()), Cell::nil());
+}
+
+void Coroutine::enter (const bytecode::Program* prog, const Cell* argv)
+{
+    auto base = top;
+    grow_(base + prog->reg_count);
+    auto r = regs.data() + base;
+    std::copy(argv, argv + prog->arg_count, r);
+    std::fill(r + prog->arg_count, r + prog->reg_count, Cell::nil());
+    top = base + prog->reg_count;
+    frames.push_back(Activation { prog, caches_for_(prog), base, 0 });
+}
+
+void Coroutine::call (const bytecode::Program* prog, size_t first)
+{
+    /* by index, since growing the registers may move them */
+    auto from = frames.back().base + first;
+    auto base = top;
+    grow_(base + prog->reg_count);
+    auto r = regs.data();
+    std::copy(r + from, r + from + prog->arg_count, r + base);
+    std::fill(r + base + prog->arg_count, r + base + prog->reg_count, Cell::nil());
+    top = base + prog->reg_count;
+    frames.push_back(Activation { prog, caches_for_(prog), base, 0 });
+}
+
+void Coroutine::tail_call (const bytecode::Program* prog, size_t first)
+{
+    auto& act = frames.back();
+    grow_(act.base + prog->reg_count);
+    auto r = regs.data() + act.base;
+    std::copy(r + first, r + first + prog->arg_count, r);
+    std::fill(r + prog->arg_count, r + prog->reg_count, Cell::nil());
+    top = act.base + prog->reg_count;
+    act = Activation { prog, caches_for_(prog), act.base, 0 };
+}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "Cell.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace bytecode {
+struct Program;
+struct FieldCache;
+}
+
+namespace run {
+
+struct State;
+
+/* a bytecode function in the middle of running. its registers are
+   those of Coroutine::regs from `base' on */
+struct Activation
+{
+    const bytecode::Program* program;
+    bytecode::FieldCache* caches;
+    size_t base;
+    // the next instruction to run; for any but the innermost
+    // activation, the one after the call it's waiting on
+    int ip;
+};
+
+/* a thread of bytecode with a stack of its own. calls from bytecode
+   to bytecode push an Activation rather than recursing on the C++
+   stack, so a coroutine can be stopped at any call to a native
+   function and resumed later (see State::suspend()), and it costs no
+   more memory than its registers while stopped.
+
+   Program::execute() runs a coroutine to completion on the spot;
+   State::spawn() makes one for the State's scheduler. a coroutine
+   links itself into its State so that the collector finds its
+   registers, and must not outlive it */
+struct Coroutine : std::enable_shared_from_this<Coroutine>
+{
+    enum Status {
+        Ready,
+        Running,
+        Suspended,
+        Done,
+        // stopped by an error, see `error'
+        Failed,
+    };
+
+    explicit Coroutine (State* state);
+    ~Coroutine ();
+    Coroutine (const Coroutine&) = delete;
+    Coroutine& operator= (const Coroutine&) = delete;
+
+    State* state;
+    Status status;
+    std::vector<Activation> frames;
+    // the registers of every activation. those from `top' on are left
+    // over from earlier calls, and never looked at again
+    std::vector<Cell> regs;
+    size_t top;
+    // the accumulator, when not running; a suspended coroutine
+    // resumes with the value it was woken with here
+    Cell acc;
+    // once Done
+    Cell result;
+    // once Failed
+    std::string error;
+
+    // run by State::run_coroutines(), and so allowed to suspend
+    bool scheduled;
+    // set by State::suspend() while a native function runs, so that
+    // the coroutine stops as soon as it returns
+    bool suspending;
+    // stopped at a tail call, so it returns the value it's woken with
+    bool return_on_resume;
+    // the coroutine that was running when this one was resumed
+    Coroutine* caller;
+
+    // starts running `prog' with a copy of `argv'
+    void enter (const bytecode::Program* prog, const Cell* argv);
+    // calls `prog' from the innermost activation, with arguments
+    // copied from its registers `first' on
+    void call (const bytecode::Program* prog, size_t first);
+    // like call(), but replaces the innermost activation
+    void tail_call (const bytecode::Program* prog, size_t first);
+    // returns from the innermost activation
+    inline void ret ()
+    {
+        top = frames.back().base;
+        frames.pop_back();
+    }
+
+    // the next of the State's live coroutines, see State::coroutines
+    inline Coroutine* next () const
+    { return next_; }
+
+private:
+    Coroutine* prev_;
+    Coroutine* next_;
+
+    bytecode::FieldCache* caches_for_ (const bytecode::Program* prog);
+    // makes room for registers up to `n'
+    void grow_ (size_t n);
+};
+
+}
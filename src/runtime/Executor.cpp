@@ -0,0 +1,287 @@
+#include "Executor.h"
+#include "Bignum.h"
+#include "Image.h"
+#include "State.h"
+#include <algorithm>
+#include <cmath>
+#include <boost/format.hpp>
+
+namespace run {
+
+/*** Values ***/
+
+Value Value::from_cell (Cell x)
+{
+    if (x.is_null())
+        return Value();
+    if (x.is_bool())
+        return Value(!x.is_false());
+    if (x.is_integer())
+        return Value(int64_t(x.integer()));
+    if (x.is_float())
+        return Value(x.floating());
+    if (x.is_string())
+        return Value(std::string(x.string()));
+
+    int64_t i;
+    if (x.is_bignum() && bignum::to_int64(x, i))
+        return Value(i);
+
+    auto fmt = boost::format
+        ("cannot pass a%s %s out of an isolate")
+        % (x.is_instance() || x.is_array() ? "n" : "") % kind_name(x.obj->kind());
+    throw std::runtime_error(fmt.str());
+}
+
+Cell Value::to_cell (State& state) const
+{
+    switch (kind) {
+    case Bool:
+        return Cell::from_bool(int_val != 0);
+    case Int:
+        return bignum::from_int128(state.gc, int_val);
+    case Float:
+        return state.gc.make_float(float_val);
+    case String:
+        return state.gc.make_string(string_val);
+    default:
+    case Null:
+        return Cell::nil();
+    }
+}
+
+
+
+/*** Executor ***/
+
+namespace {
+
+// where a worker keeps the globals as setup left them; not a name
+// that source code can refer to
+const char* SavedGlobals = " saved globals";
+
+}
+
+Executor::Executor (ExecutorOptions opts)
+    : opts_(std::move(opts))
+    , started_(Clock::now())
+    , stopping_(false)
+    , submitted_(0)
+    , completed_(0)
+    , failed_(0)
+    , total_latency_ms_(0)
+    , max_latency_ms_(0)
+{
+    std::fill(latencies_, latencies_ + LatencyBuckets, 0);
+
+    unsigned n = opts_.isolates;
+    if (n == 0)
+        n = std::max(1u, std::thread::hardware_concurrency());
+    // read by the workers, while workers_ is still being filled
+    opts_.isolates = n;
+
+    /* isolates are set up on their own threads; wait for them all, so
+       that a failing setup is reported here */
+    std::vector<std::promise<void>> started(n);
+    for (unsigned i = 0; i < n; i++)
+        workers_.emplace_back(&Executor::work_, this, std::ref(started[i]));
+
+    std::exception_ptr error;
+    for (auto& s : started) {
+        try {
+            s.get_future().get();
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+    }
+    if (error) {
+        stop_();
+        std::rethrow_exception(error);
+    }
+}
+
+Executor::~Executor ()
+{
+    stop_();
+}
+
+void Executor::stop_ ()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    ready_.notify_all();
+    for (auto& t : workers_)
+        if (t.joinable())
+            t.join();
+}
+
+std::future<Value> Executor::submit (std::string function, std::vector<Value> args)
+{
+    Job job;
+    job.function = std::move(function);
+    job.args = std::move(args);
+    job.submitted = Clock::now();
+    auto result = job.result.get_future();
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        if (stopping_)
+            throw std::runtime_error("executor is shutting down");
+        queue_.push_back(std::move(job));
+        submitted_++;
+    }
+    ready_.notify_one();
+    return result;
+}
+
+void Executor::work_ (std::promise<void>& started)
+{
+    std::unique_ptr<State> state;
+    Symbol saved;
+    size_t nglobals;
+    try {
+        state.reset(opts_.image ? new State(*opts_.image) : new State);
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        state->gc.set_mark_threads(cores / opts_.isolates);
+        if (opts_.setup)
+            opts_.setup(*state);
+
+        /* the copy is itself a global, so that it stays alive (and is
+           updated if the collector moves things) */
+        saved = state->env.intern(SavedGlobals);
+        auto& globals = state->env.globals;
+        nglobals = globals.size();
+        auto copy = state->gc.make_array(nglobals);
+        std::copy(globals.begin(), globals.end(), copy.children().begin());
+        state->env.global(saved) = copy;
+        copy.children()[saved] = copy;
+        started.set_value();
+    }
+    catch (...) {
+        started.set_exception(std::current_exception());
+        return;
+    }
+
+    for (size_t jobs = 1; ; jobs++) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(lock_);
+            ready_.wait(guard, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty())
+                return;
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        /* counted before the result is handed over, so that stats()
+           agrees with what callers have seen */
+        Value result;
+        std::exception_ptr error;
+        try {
+            result = run_(*state, job);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        finished_(job, !error);
+        if (error)
+            job.result.set_exception(error);
+        else
+            job.result.set_value(std::move(result));
+
+        /* a job that failed may have left coroutines ready to run;
+           they'd be roots for as long as they were kept */
+        state->drop_coroutines();
+
+        if (opts_.reset_globals) {
+            auto& globals = state->env.globals;
+            auto copy = globals[saved].children();
+            std::copy(copy.begin(), copy.end(), globals.begin());
+            std::fill(globals.begin() + nglobals, globals.end(), Cell::nil());
+        }
+
+        if (opts_.collect_every > 0 && jobs % opts_.collect_every == 0)
+            state->gc.collect(state.get());
+        else if (state->gc.wants_collect())
+            state->gc.safepoint(state.get());
+    }
+}
+
+Value Executor::run_ (State& state, Job& job)
+{
+    auto fn = state.env.get_function(job.function);
+    if (fn == nullptr) {
+        auto fmt = boost::format("no function `%s'") % job.function;
+        throw std::runtime_error(fmt.str());
+    }
+
+    /* keeps the arguments and the result alive while the function
+       runs */
+    std::vector<Cell> args(job.args.size(), Cell::nil());
+    Cell result = Cell::nil();
+    Frame frame(&state, args.data(), args.size(), &result);
+    for (size_t i = 0; i < args.size(); i++)
+        args[i] = job.args[i].to_cell(state);
+
+    auto impl = fn->dispatch(args.data(), args.size());
+    if (impl == nullptr) {
+        auto fmt = boost::format
+            ("no implementation of function `%s' matches the given %d argument(s)")
+            % fn->name % args.size();
+        throw std::runtime_error(fmt.str());
+    }
+    result = impl->call(&state, args.data());
+    // coroutines the job spawned are part of it
+    state.run_coroutines();
+    return Value::from_cell(result);
+}
+
+void Executor::finished_ (const Job& job, bool ok)
+{
+    auto latency = std::chrono::duration<double, std::milli>(Clock::now() - job.submitted).count();
+    double us = std::max(latency * 1000, 1.0);
+    auto bucket = std::min(int(LatencyBuckets) - 1, int(4 * std::log2(us)));
+
+    std::lock_guard<std::mutex> guard(lock_);
+    completed_++;
+    if (!ok)
+        failed_++;
+    total_latency_ms_ += latency;
+    max_latency_ms_ = std::max(max_latency_ms_, latency);
+    latencies_[bucket]++;
+}
+
+// the upper end of the bucket the p'th latency falls in
+double Executor::percentile_ (double p) const
+{
+    size_t want = size_t(std::ceil(p * completed_)), seen = 0;
+    for (int b = 0; b < LatencyBuckets; b++) {
+        seen += latencies_[b];
+        if (seen >= want && seen > 0)
+            return std::min(max_latency_ms_, std::exp2((b + 1) / 4.0) / 1000);
+    }
+    return max_latency_ms_;
+}
+
+ExecutorStats Executor::stats () const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    ExecutorStats s;
+    s.submitted = submitted_;
+    s.completed = completed_;
+    s.failed = failed_;
+    s.queued = queue_.size();
+    if (completed_ > 0) {
+        s.mean_latency_ms = total_latency_ms_ / completed_;
+        s.p50_latency_ms = percentile_(0.5);
+        s.p99_latency_ms = percentile_(0.99);
+        s.max_latency_ms = max_latency_ms_;
+    }
+    auto uptime = std::chrono::duration<double>(Clock::now() - started_).count();
+    s.throughput = completed_ / uptime;
+    return s;
+}
+
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include "Cell.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace run {
+
+struct State;
+struct Image;
+
+/* a value that can be passed into and out of a State: cells belong
+   to the heap of one State, so calls from outside take and return
+   these instead */
+struct Value
+{
+    enum Kind { Null, Bool, Int, Float, String };
+
+    Value () : kind(Null), int_val(0) {}
+    Value (bool b) : kind(Bool), int_val(b) {}
+    Value (int i) : kind(Int), int_val(i) {}
+    Value (int64_t i) : kind(Int), int_val(i) {}
+    Value (double d) : kind(Float), float_val(d) {}
+    Value (const char* s) : kind(String), int_val(0), string_val(s) {}
+    Value (std::string s) : kind(String), int_val(0), string_val(std::move(s)) {}
+
+    Kind kind;
+    union {
+        int64_t int_val;
+        double float_val;
+    };
+    std::string string_val;
+
+    // throws for anything but the kinds above, or integers outside
+    // the range of int64_t
+    static Value from_cell (Cell x);
+    Cell to_cell (State& state) const;
+};
+
+
+struct ExecutorOptions
+{
+    // isolates, each with a thread of its own; 0 for one per core.
+    // each collects on its share of the cores
+    unsigned isolates = 0;
+    // if given, isolates are made from this image (which must outlive
+    // the executor) rather than each loading the standard library
+    const Image* image = nullptr;
+    // run in each isolate once, after the standard library is
+    // loaded, to define the functions that jobs will call
+    std::function<void (State&)> setup;
+    /* after every job, put each global binding back to the value
+       setup left it with, and clear globals the job added. only the
+       bindings are restored: an object setup stored in a global (a
+       table, say) keeps whatever changes a job made to it, and
+       functions or implementations a job defined stay defined. so
+       jobs only can't see each other's data if they don't change
+       setup's objects; what this does guarantee is that whatever a
+       job left only in globals becomes garbage */
+    bool reset_globals = true;
+    // collect after every this many jobs on an isolate; 0 to leave
+    // it to the collector, which is then given the chance between jobs
+    size_t collect_every = 0;
+};
+
+struct ExecutorStats
+{
+    size_t submitted = 0;
+    size_t completed = 0;
+    size_t failed = 0;
+    size_t queued = 0;
+    // time from submission to the result being ready, in ms
+    double mean_latency_ms = 0, p50_latency_ms = 0, p99_latency_ms = 0,
+        max_latency_ms = 0;
+    // completed jobs per second since the executor was started
+    double throughput = 0;
+};
+
+/* runs calls to named functions on a pool of isolates (States) that
+   are set up once and reused. a call goes to whichever isolate is
+   free first, so setup must leave every isolate the same.
+
+     ExecutorOptions opts;
+     opts.setup = [] (State& st) { ... define "handle" ... };
+     Executor ex(opts);
+     auto result = ex.submit("handle", { 42, "text" });
+     result.get();   // the Value returned, or rethrows its error */
+class Executor
+{
+public:
+    explicit Executor (ExecutorOptions opts = ExecutorOptions());
+    // finishes the jobs already queued
+    ~Executor ();
+
+    std::future<Value> submit (std::string function, std::vector<Value> args);
+
+    ExecutorStats stats () const;
+
+    inline unsigned isolates () const
+    { return unsigned(workers_.size()); }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Job
+    {
+        std::string function;
+        std::vector<Value> args;
+        std::promise<Value> result;
+        Clock::time_point submitted;
+    };
+
+    ExecutorOptions opts_;
+    std::vector<std::thread> workers_;
+    Clock::time_point started_;
+
+    mutable std::mutex lock_;
+    std::condition_variable ready_;
+    std::deque<Job> queue_;
+    bool stopping_;
+
+    // under lock_
+    size_t submitted_, completed_, failed_;
+    double total_latency_ms_, max_latency_ms_;
+    // completed jobs by latency, in buckets a quarter-octave wide
+    // starting at 1us
+    enum { LatencyBuckets = 128 };
+    size_t latencies_[LatencyBuckets];
+
+    void stop_ ();
+    void work_ (std::promise<void>& started);
+    Value run_ (State& state, Job& job);
+    void finished_ (const Job& job, bool ok);
+    double percentile_ (double p) const;
+};
+
+}
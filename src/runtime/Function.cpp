@@ -1,16 +1,175 @@
 #include "Function.h"
 #include "../syntax/AST.h"
+#include "../bytecode/Program.h"
+#include <unordered_map>
 
 namespace run {
 
-Cell FunctionImpl::call (State* state, Cell* args)
+/* the dispatch table is a decision tree with one level per
+   argument. each node maps the datatype of the next argument to
+   a child, falling back to `any' for arguments of other types.
+   untyped parameters are copied into every typed branch while
+   building, so lookup never has to backtrack. */
+struct Function::DispatchNode
+{
+    DispatchNode ()
+        : impl(-1)
+    {}
+
+    std::unordered_map<Object*, std::unique_ptr<DispatchNode>> by_type;
+    std::unique_ptr<DispatchNode> any;
+    // index into `implementations', for leaves only
+    int impl;
+};
+
+namespace {
+
+using Node = std::unique_ptr<Function::DispatchNode>;
+
+Node build_dispatch (const std::vector<FunctionImpl>& impls,
+                     const std::vector<int>& candidates,
+                     size_t arg)
+{
+    if (candidates.empty())
+        return nullptr;
+
+    Node node(new Function::DispatchNode);
+
+    /* leaf: every candidate accepts the arguments, pick the best */
+    if (arg == impls[candidates[0]].arg_count) {
+        int best = candidates[0];
+        for (auto i : candidates)
+            if (!impls[best].more_specific(impls[i]))
+                best = i;
+        node->impl = best;
+        return node;
+    }
+
+    std::vector<int> untyped;
+    for (auto i : candidates)
+        if (impls[i].arg_types[arg].is_null())
+            untyped.push_back(i);
+
+    for (auto i : candidates) {
+        auto type = impls[i].arg_types[arg].obj;
+        if (type == nullptr || node->by_type.count(type))
+            continue;
+
+        std::vector<int> matching;
+        for (auto j : candidates)
+            if (impls[j].arg_types[arg].obj == type
+                || impls[j].arg_types[arg].is_null())
+                matching.push_back(j);
+        node->by_type[type] = build_dispatch(impls, matching, arg + 1);
+    }
+
+    node->any = build_dispatch(impls, untyped, arg + 1);
+    return node;
+}
+
+}
+
+Function::Function (std::string n)
+    : name(std::move(n))
+{}
+
+Function::~Function ()
+{}
+
+FunctionImpl& Function::add_impl (FunctionImpl impl)
+{
+    implementations.push_back(std::move(impl));
+    update_dispatch();
+    return implementations.back();
+}
+
+void Function::update_dispatch ()
+{
+    dispatch_roots_.clear();
+
+    size_t max_argc = 0;
+    for (auto& impl : implementations)
+        max_argc = std::max(max_argc, impl.arg_count);
+    dispatch_roots_.resize(max_argc + 1);
+
+    for (size_t argc = 0; argc <= max_argc; argc++) {
+        std::vector<int> candidates;
+        for (size_t i = 0; i < implementations.size(); i++)
+            if (implementations[i].arg_count == argc)
+                candidates.push_back(int(i));
+        dispatch_roots_[argc] = build_dispatch(implementations, candidates, 0);
+    }
+}
+
+const FunctionImpl* Function::dispatch (const Cell* args, size_t argc) const
+{
+    if (argc >= dispatch_roots_.size())
+        return nullptr;
+
+    auto node = dispatch_roots_[argc].get();
+    for (size_t i = 0; node && i < argc; i++) {
+        if (!node->by_type.empty()) {
+            auto it = node->by_type.find(args[i].get_type().obj);
+            if (it != node->by_type.end()) {
+                node = it->second.get();
+                continue;
+            }
+        }
+        node = node->any.get();
+    }
+
+    if (node == nullptr)
+        return nullptr;
+    return &implementations[node->impl];
+}
+
+
+
+FunctionImpl::FunctionImpl (const bytecode::Program* prog)
+    : arg_count(prog->arg_count)
+    , arg_types(prog->arg_count, Cell::nil())
+    , native_fn_ptr(nullptr)
+    , program(prog)
+    , to_be_compiled(nullptr)
+{
+}
+
+FunctionImpl::FunctionImpl (std::vector<Cell> types, const bytecode::Program* prog)
+    : arg_count(types.size())
+    , arg_types(std::move(types))
+    , native_fn_ptr(nullptr)
+    , program(prog)
+    , to_be_compiled(nullptr)
+{
+    if (arg_count != prog->arg_count)
+        throw std::runtime_error("argument types don't match the program's arguments");
+}
+
+Cell FunctionImpl::call (State* state, Cell* args) const
 {
     if (native_fn_ptr) {
         return native_fn_ptr(state, args);
     }
+    else if (program) {
+        return program->execute(state, args);
+    }
     else {
         throw std::runtime_error("missing implementation of function");
     }
 }
 
+bool FunctionImpl::more_specific (const FunctionImpl& other) const
+{
+    /* the first typed parameter (from the left) wins; with identical
+       patterns, the implementation defined later wins, so callers
+       must compare in definition order */
+    for (size_t i = 0; i < arg_count; i++) {
+        bool typed = !arg_types[i].is_null();
+        bool other_typed = !other.arg_types[i].is_null();
+        if (typed != other_typed)
+            return typed;
+    }
+    return false;
+}
+
 }
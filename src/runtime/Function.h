@@ -2,12 +2,17 @@
 #include <string>
 #include <cstdint>
 #include <vector>
+#include <memory>
 #include "Cell.h"
 
 namespace ast {
 struct FunctionDefn;
 }
 
+namespace bytecode {
+struct Program;
+}
+
 
 namespace run {
 
@@ -17,12 +22,28 @@ using NativeFnPtr = Cell (*)(State*,Cell*);
 
 struct Function
 {
-    inline Function (std::string n)
-        : name(std::move(n))
-    {}
+    Function (std::string n);
+    ~Function ();
 
     std::string name;
     std::vector<FunctionImpl> implementations;
+
+    // add an implementation and rebuild the dispatch table
+    FunctionImpl& add_impl (FunctionImpl impl);
+    // rebuild the dispatch table; only necessary after modifying
+    // the `arg_types' of an existing implementation
+    void update_dispatch ();
+
+    // select the most specific implementation accepting `args',
+    // or nullptr if there is none. cost is O(argc) regardless
+    // of the number of implementations
+    const FunctionImpl* dispatch (const Cell* args, size_t argc) const;
+
+    struct DispatchNode;
+
+private:
+    // indexed by argument count
+    std::vector<std::unique_ptr<DispatchNode>> dispatch_roots_;
 };
 
 
@@ -30,23 +51,44 @@ struct FunctionImpl
 {
     inline explicit FunctionImpl (size_t argc)
         : arg_count(argc)
+        , arg_types(argc, Cell::nil())
         , native_fn_ptr(nullptr)
+        , program(nullptr)
         , to_be_compiled(nullptr)
     {}
     inline FunctionImpl (size_t argc,
                          NativeFnPtr impl)
         : arg_count(argc)
+        , arg_types(argc, Cell::nil())
+        , native_fn_ptr(impl)
+        , program(nullptr)
+        , to_be_compiled(nullptr)
+    {}
+    inline FunctionImpl (std::vector<Cell> types,
+                         NativeFnPtr impl)
+        : arg_count(types.size())
+        , arg_types(std::move(types))
         , native_fn_ptr(impl)
+        , program(nullptr)
         , to_be_compiled(nullptr)
     {}
+    // takes as many arguments as `prog' does, which must outlive it
+    explicit FunctionImpl (const bytecode::Program* prog);
+    FunctionImpl (std::vector<Cell> types, const bytecode::Program* prog);
 
     size_t arg_count;
+    // datatype required of each argument, or null to accept any
+    std::vector<Cell> arg_types;
     NativeFnPtr native_fn_ptr;
+    // called from bytecode without recursing; see run::Coroutine
+    const bytecode::Program* program;
     ast::FunctionDefn* to_be_compiled;
 
-    // TODO: compiled bytecode
+    Cell call (State* state, Cell* args) const;
 
-    Cell call (State* state, Cell* args);
+    // true if this implementation should be preferred over `other'
+    // when both accept the same arguments
+    bool more_specific (const FunctionImpl& other) const;
 };
 
 
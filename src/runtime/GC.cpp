@@ -1,24 +1,256 @@
 #include "GC.h"
+#include "State.h"
+#include "Collections.h"
+#include "../bytecode/Program.h"
 #include <cstring>
+#include <sys/mman.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 namespace run {
 
-GC::GC ()
+namespace {
+typedef std::chrono::steady_clock Clock;
+
+inline double ms_since (Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// minimum bytes allocated between collections
+const size_t MinThreshold = 1 << 20;
+// heaps with fewer objects than this are marked on one thread, since
+// starting the others would cost more than it saves
+const size_t ParallelMarkMin = 1 << 16;
+
+// objects of at least this many bytes are allocated on their own
+// rather than from chunks, and never move
+const size_t LargeObject = 1 << 13;
+const size_t ChunkSize = Chunk::Size;
+// chunks with fewer live bytes than this are evacuated by compaction
+const size_t EvacuateBelow = ChunkSize / 2;
+
+// strings and packed arrays with contents of at least this many
+// bytes keep them in a Payload, see Object::External
+const size_t ExternalMin = LargeObject;
+
+// bytes an object takes up, including its payload
+inline size_t footprint (Object* obj)
+{
+    size_t bytes = sizeof(Object) + obj->size;
+    if (obj->type & Object::External)
+        bytes += obj->contents_size();
+    return bytes;
+}
+
+// frees an object, or if it's in a chunk, just what it refers to
+// outside of the heap
+inline void free_object (Object* obj)
+{
+    if (obj->type & Object::External) {
+        if (auto payload = obj->data_as_external()->payload)
+            payload->release();
+    }
+    if (!(obj->gc_status & GCStatus::InChunk))
+        delete[] reinterpret_cast<char*>(obj);
+}
+
+// bytes taken by an object in a chunk, keeping the next one aligned
+inline size_t chunk_bytes (size_t bytes)
+{
+    return (bytes + 7) & ~size_t(7);
+}
+
+/* chunks are mapped directly rather than taken from malloc, so that
+   releasing one really gives the memory back. mapping twice the size
+   and trimming is the simplest way to get the alignment */
+void* map_chunk ()
+{
+    void* mem = mmap(nullptr, 2 * ChunkSize, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+        throw std::bad_alloc();
+
+    auto base = uintptr_t(mem);
+    auto aligned = (base + ChunkSize - 1) & ~uintptr_t(ChunkSize - 1);
+    if (aligned > base)
+        munmap(mem, aligned - base);
+    munmap(reinterpret_cast<void*>(aligned + ChunkSize), base + ChunkSize - aligned);
+    return reinterpret_cast<void*>(aligned);
+}
+
+inline void unmap_chunk (void* chunk)
+{
+    munmap(chunk, ChunkSize);
+}
+}
+
+GC::GC (State* owner)
+    : owner_(owner)
+    , alloc_chunk_(nullptr)
+    , compacting_(false)
+    , bytes_since_collect_(0)
+    , bytes_since_slice_(0)
+    , threshold_(MinThreshold)
+    , mark_threads_(1)
+    , incremental_(false)
+    , slice_budget_(1000)
+    , phase_(Idle)
+    , sweep_pos_(0)
+    , sweep_live_(0)
+    , sweep_end_(0)
+    , live_bytes_(0)
+    , sample_countdown_(0)
+{
+}
+
+GC::~GC ()
 {
+    for (auto obj : objects_)
+        free_object(obj);
+    for (auto chunk : chunks_)
+        unmap_chunk(chunk);
 }
 
 
 /*** Allocation ***/
 
-Cell GC::alloc_ (uint8_t type, uint16_t size)
+Cell GC::alloc_ (uint8_t type, uint32_t size)
 {
-    Object* obj = reinterpret_cast<Object*>(new char[sizeof(Object) + size]);
+    Object* obj;
+    uint8_t status = GCStatus::NewlyAllocated;
+    if (sizeof(Object) + size < LargeObject) {
+        obj = reuse_slot_(sizeof(Object) + size);
+        if (obj == nullptr)
+            obj = chunk_alloc_(sizeof(Object) + size);
+        status |= GCStatus::InChunk;
+    }
+    else {
+        obj = reinterpret_cast<Object*>(new char[sizeof(Object) + size]);
+    }
     obj->type = type;
-    obj->gc_status = GCStatus::NewlyAllocated;
+    obj->gc_status = status;
+    obj->shape = 0;
     obj->size = size;
+    objects_.push_back(obj);
+    bytes_since_collect_ += sizeof(Object) + size;
+    bytes_since_slice_ += sizeof(Object) + size;
+    stats_.allocated.objects++;
+    stats_.allocated.bytes += sizeof(Object) + size;
+    if (stats_.sample_interval > 0
+        && (sample_countdown_ -= ptrdiff_t(sizeof(Object) + size)) <= 0)
+        sample_alloc_();
+
+    /* allocated black while marking, so anything the constructor
+       stores into it has to go through the write barrier */
+    if (phase_ == Marking)
+        set_marked(obj);
     return Cell(obj);
 }
 
+Object* GC::alloc_detached (uint8_t type, uint32_t size)
+{
+    auto obj = reinterpret_cast<Object*>(new char[sizeof(Object) + size]);
+    obj->type = type;
+    obj->gc_status = 0;
+    obj->shape = 0;
+    obj->size = size;
+    return obj;
+}
+
+Object* GC::detached_string (boost::string_ref s)
+{
+    size_t len = s.size();
+    Object* obj;
+    if (len + 1 >= ExternalMin) {
+        obj = alloc_detached(Object::String | Object::External, sizeof(Object::ExternalDesc));
+        obj->data_as_external()->payload = Payload::make(len + 1);
+    }
+    else {
+        obj = alloc_detached(Object::String, len + 1);
+    }
+    auto chars = obj->contents();
+    std::memcpy(chars, s.data(), len);
+    chars[len] = '\0';
+    return obj;
+}
+
+void GC::free_detached (Object* obj)
+{
+    free_object(obj);
+}
+
+void GC::adopt (const std::vector<Object*>& objects)
+{
+    for (auto obj : objects) {
+        obj->gc_status = GCStatus::NewlyAllocated;
+        if (phase_ == Marking)
+            set_marked(obj);
+        objects_.push_back(obj);
+
+        auto bytes = footprint(obj);
+        bytes_since_collect_ += bytes;
+        bytes_since_slice_ += bytes;
+        stats_.allocated.objects++;
+        stats_.allocated.bytes += bytes;
+    }
+}
+
+Object* GC::chunk_alloc_ (size_t bytes)
+{
+    bytes = chunk_bytes(bytes);
+    auto chunk = alloc_chunk_;
+    if (chunk == nullptr || chunk->top + bytes > chunk->end) {
+        void* mem = map_chunk();
+
+        chunk = alloc_chunk_ = static_cast<Chunk*>(mem);
+        chunk->top = static_cast<char*>(mem) + chunk_bytes(sizeof(Chunk));
+        chunk->end = static_cast<char*>(mem) + ChunkSize;
+        chunk->live_bytes = 0;
+        chunk->evacuate = false;
+        // fresh mappings are zero filled, so no marks are set
+        chunks_.push_back(chunk);
+    }
+
+    auto obj = reinterpret_cast<Object*>(chunk->top);
+    chunk->top += bytes;
+    return obj;
+}
+
+// the space of a dead object of the same size, if there is one
+Object* GC::reuse_slot_ (size_t bytes)
+{
+    auto granules = chunk_bytes(bytes) / Chunk::Granule;
+    if (granules >= free_slots_.size() || free_slots_[granules].empty())
+        return nullptr;
+    auto obj = free_slots_[granules].back();
+    free_slots_[granules].pop_back();
+    return obj;
+}
+
+void GC::sample_alloc_ ()
+{
+    sample_countdown_ += ptrdiff_t(stats_.sample_interval);
+
+    std::string program = "<native>";
+    int ip = -1;
+    /* bytecode only allocates through calls, so the innermost
+       activation is stopped at one */
+    auto co = owner_ ? owner_->current_coroutine : nullptr;
+    if (co && !co->frames.empty()) {
+        auto& act = co->frames.back();
+        program = act.program->name.empty() ? "<anonymous>" : act.program->name;
+        ip = act.ip - 1;
+    }
+
+    auto& site = stats_.sites[std::make_pair(program, ip)];
+    site.samples++;
+    site.bytes += stats_.sample_interval;
+}
+
 Cell GC::make_array (size_t nelems)
 {
     auto obj_arr = alloc_(Object::Array, nelems * sizeof(Cell));
@@ -27,15 +259,145 @@ Cell GC::make_array (size_t nelems)
     return obj_arr;
 }
 
+Cell GC::make_vector (size_t capacity)
+{
+    auto items = make_array(capacity);
+    auto obj_vec = alloc_(Object::Vector, 2 * sizeof(Cell));
+    obj_vec.children()[0] = items;
+    obj_vec.children()[1] = Cell::from_fixnum(0);
+    return obj_vec;
+}
+
+Cell GC::make_table (size_t capacity)
+{
+    size_t slots = 8;
+    while (slots < capacity)
+        slots *= 2;
+
+    auto keys = make_array(slots);
+    auto values = make_array(slots);
+    auto obj_tbl = alloc_(Object::Table, 3 * sizeof(Cell));
+    obj_tbl.children()[0] = keys;
+    obj_tbl.children()[1] = values;
+    obj_tbl.children()[2] = Cell::from_fixnum(0);
+    return obj_tbl;
+}
+
+Cell GC::make_packed (uint8_t kind, size_t nelems)
+{
+    size_t bytes = nelems * Object::packed_elem_size(kind);
+    if (bytes >= ExternalMin) {
+        auto obj_pk = make_external_(kind, Payload::make(bytes));
+        std::memset(obj_pk.obj->contents(), 0, bytes);
+        return obj_pk;
+    }
+
+    auto obj_pk = alloc_(kind, bytes);
+    std::memset(obj_pk.obj->data, 0, obj_pk.obj->size);
+    return obj_pk;
+}
+
+Cell GC::make_bignum (bool negative, const uint32_t* limbs, size_t count)
+{
+    auto obj_big = alloc_(Object::Bignum,
+                          sizeof(Object::BignumDesc) + count * sizeof(uint32_t));
+    auto& desc = *obj_big.obj->data_as_bignum();
+    desc.negative = negative;
+    desc.count = uint32_t(count);
+    std::memcpy(desc.limbs, limbs, count * sizeof(uint32_t));
+    return obj_big;
+}
+
+Cell GC::make_float (double d)
+{
+    Cell imm;
+    if (Cell::immediate_float(d, imm))
+        return imm;
+
+    auto obj_flo = alloc_(Object::Float, sizeof(double));
+    *obj_flo.obj->data_as_float() = d;
+    return obj_flo;
+}
+
 Cell GC::make_string (boost::string_ref s)
 {
     auto len = s.size();
-    auto obj_str = alloc_(Object::String, len + 1);
-    std::memcpy(obj_str.obj->data, s.data(), len);
-    obj_str.obj->data[len] = '\0'; // a NULL terminator, for good luck.
+    if (len <= Cell::SmallStringMax)
+        return Cell::small_string(s);
+
+    Cell obj_str;
+    if (len + 1 >= ExternalMin)
+        obj_str = make_external_(Object::String, Payload::make(len + 1));
+    else
+        obj_str = alloc_(Object::String, len + 1);
+    auto chars = obj_str.obj->contents();
+    std::memcpy(chars, s.data(), len);
+    chars[len] = '\0'; // a NULL terminator, for good luck.
     return obj_str;
 }
 
+Cell GC::make_external_ (uint8_t type, Payload* payload)
+{
+    auto obj_ext = alloc_(type | Object::External, sizeof(Object::ExternalDesc));
+    obj_ext.obj->data_as_external()->payload = payload;
+    count_payload_(payload->size);
+    return obj_ext;
+}
+
+void GC::count_payload_ (size_t bytes)
+{
+    bytes_since_collect_ += bytes;
+    bytes_since_slice_ += bytes;
+    stats_.allocated.bytes += bytes;
+}
+
+Cell GC::make_string_slice_ (Object* buffer, size_t length)
+{
+    auto obj_slice = alloc_(Object::String | Object::StringSlice,
+                            sizeof(Object::StringSliceDesc));
+    auto& slice = *obj_slice.obj->data_as_string_slice();
+    write_barrier(buffer);
+    slice.buffer = buffer;
+    slice.length = length;
+    return obj_slice;
+}
+
+Cell GC::concat (Cell a, Cell b)
+{
+    auto str_a = a.string();
+    auto str_b = b.string();
+    size_t len = str_a.size() + str_b.size();
+
+    if (len <= Cell::SmallStringMax) {
+        char chars[Cell::SmallStringMax];
+        std::memcpy(chars, str_a.data(), str_a.size());
+        std::memcpy(chars + str_a.size(), str_b.data(), str_b.size());
+        return Cell::small_string(boost::string_ref(chars, len));
+    }
+
+    /* append in place if `a' ends where its buffer does */
+    if (a.is_object() && a.is_string_slice()) {
+        auto buffer = a.obj->data_as_string_slice()->buffer;
+        auto& buf = *buffer->data_as_string_buffer();
+        size_t capacity = buffer->size - sizeof(Object::StringBufferDesc);
+        if (buf.used == str_a.size() && len <= capacity) {
+            std::memcpy(buf.chars + buf.used, str_b.data(), str_b.size());
+            buf.used = len;
+            return make_string_slice_(buffer, len);
+        }
+    }
+
+    /* otherwise start a new buffer, with room to grow */
+    size_t capacity = std::max<size_t>(len * 2, 32);
+    auto obj_buf = alloc_(Object::String,
+                          sizeof(Object::StringBufferDesc) + capacity);
+    auto& buf = *obj_buf.obj->data_as_string_buffer();
+    std::memcpy(buf.chars, str_a.data(), str_a.size());
+    std::memcpy(buf.chars + str_a.size(), str_b.data(), str_b.size());
+    buf.used = len;
+    return make_string_slice_(obj_buf.obj, len);
+}
+
 Cell GC::make_datatype (Cell::DatatypeFields field_names)
 {
     size_t total_size = sizeof(Object::DatatypeDesc);
@@ -44,8 +406,20 @@ Cell GC::make_datatype (Cell::DatatypeFields field_names)
         total_size += sizeof(boost::string_ref);
     }
 
-    /* allocate Datatype object */
-    auto obj_dt = alloc_(Object::Datatype, total_size);
+    auto id = Cell::datatype_count.fetch_add(1);
+    if (id >= Cell::MaxDatatypes)
+        throw std::runtime_error("too many datatypes");
+
+    /* allocate Datatype object. it's registered for good rather than
+       being tracked by the collector, so it's static */
+    Object* obj = reinterpret_cast<Object*>(new char[sizeof(Object) + total_size]);
+    obj->type = Object::Datatype | Object::Static;
+    obj->gc_status = 0;
+    obj->shape = uint16_t(id);
+    obj->size = uint32_t(total_size);
+    Cell::datatypes[id] = obj;
+
+    Cell obj_dt(obj);
     auto& desc = *obj_dt.obj->data_as_datatype_desc();
     desc.count = field_names.size();
 
@@ -73,14 +447,14 @@ Cell GC::make_instance (Cell datatype, Cell* argv)
     auto dt_desc = *datatype.obj->data_as_datatype_desc();
     size_t num_fields = dt_desc.count;
 
-    auto obj_inst = alloc_(0, num_fields * sizeof(Cell));
+    /* the datatype goes in the header, so the children are
+       just the fields */
+    auto obj_inst = alloc_(Object::Instance, num_fields * sizeof(Cell));
+    obj_inst.obj->shape = datatype.obj->shape;
     auto children = obj_inst.children();
-
-    /* first child is the datatype */
-    children[0] = datatype;
-    /* rest are the fields */
     for (size_t i = 0; i < num_fields; i++) {
-        children[i + 1] = argv[i];
+        write_barrier(argv[i]);
+        children[i] = argv[i];
     }
     return obj_inst;
 }
@@ -90,23 +464,509 @@ Cell GC::make_instance (Cell datatype, Cell* argv)
 
 /*** Collection ***/
 
+namespace {
+
+// calls `f' on (a reference to) each root
+template <typename F>
+void each_root (State* state, F f)
+{
+    auto& env = state->env;
+    for (auto& glob : env.globals)
+        f(glob);
+
+    for (auto& fn : env.functions)
+        if (fn)
+            for (auto& impl : fn->implementations)
+                for (auto& type : impl.arg_types)
+                    f(type);
+
+    for (auto frame = state->frame; frame; frame = frame->parent) {
+        for (size_t i = 0; i < frame->reg_count; i++)
+            f(frame->regs[i]);
+        f(*frame->acc);
+    }
+
+    for (auto co = state->coroutines; co; co = co->next()) {
+        for (size_t i = 0; i < co->top; i++)
+            f(co->regs[i]);
+        f(co->acc);
+        f(co->result);
+    }
+}
+
+// calls `f' on each collectable object that `obj' refers to
+template <typename F>
+inline void each_child (Object* obj, F f)
+{
+    Cell v(obj);
+    if (v.has_children()) {
+        for (auto child : v.children())
+            if (child.is_object() && !child.is_static())
+                f(child.obj);
+    }
+    else if (v.is_string_slice()) {
+        f(obj->data_as_string_slice()->buffer);
+    }
+}
+
+/* marking on several threads. each worker has a private stack, and a
+   shared one that others may steal from when they run out. a busy
+   worker hands over a batch when it sees that someone is idle, and
+   marking is done once every worker is idle at the same time. */
+class ParallelMarker
+{
+public:
+    explicit ParallelMarker (unsigned nthreads)
+        : workers_(nthreads)
+        , idle_(0)
+    {}
+
+    // marks everything reachable from `roots', which are already marked
+    void run (const std::vector<Object*>& roots)
+    {
+        /* deal the roots out, then run the workers; the calling thread
+           is one of them */
+        for (size_t i = 0; i < roots.size(); i++)
+            workers_[i % workers_.size()].shared.push_back(roots[i]);
+
+        std::vector<std::thread> threads;
+        for (unsigned id = 1; id < workers_.size(); id++)
+            threads.emplace_back([this, id] { work_(id); });
+        work_(0);
+        for (auto& t : threads)
+            t.join();
+    }
+
+private:
+    // the most objects handed over at once
+    enum { Batch = 256 };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::vector<Object*> shared;
+    };
+    std::vector<Worker> workers_;
+    std::atomic<unsigned> idle_;
+
+    // true if this thread is the one to mark `obj'
+    static inline bool try_mark_ (Object* obj)
+    {
+        if (obj->gc_status & GCStatus::InChunk)
+            return Chunk::of(obj)->mark_atomic(obj);
+        auto old = __atomic_fetch_or(&obj->gc_status, uint8_t(Marked),
+                                     __ATOMIC_RELAXED);
+        return !(old & Marked);
+    }
+
+    void work_ (unsigned id)
+    {
+        std::vector<Object*> stack;
+        auto& self = workers_[id];
+        for (;;) {
+            while (!stack.empty()) {
+                auto obj = stack.back();
+                stack.pop_back();
+                each_child(obj, [&stack] (Object* child) {
+                    if (try_mark_(child))
+                        stack.push_back(child);
+                });
+
+                if (stack.size() > Batch && idle_.load(std::memory_order_relaxed) > 0) {
+                    std::lock_guard<std::mutex> guard(self.lock);
+                    if (self.shared.empty()) {
+                        self.shared.assign(stack.end() - Batch / 2, stack.end());
+                        stack.resize(stack.size() - Batch / 2);
+                    }
+                }
+            }
+            if (steal_(id, stack))
+                continue;
+
+            /* out of work. a worker only goes idle once its own shared
+               stack is empty, and only it adds to that stack, so when
+               all are idle there is nothing left anywhere */
+            idle_++;
+            for (;;) {
+                if (idle_.load() == workers_.size())
+                    return;
+                std::this_thread::yield();
+                if (any_shared_()) {
+                    idle_--;
+                    if (steal_(id, stack))
+                        break;
+                    idle_++;
+                }
+            }
+        }
+    }
+
+    // takes everything from our own shared stack, or else up to half of
+    // someone else's
+    bool steal_ (unsigned id, std::vector<Object*>& out)
+    {
+        for (size_t k = 0; k < workers_.size(); k++) {
+            auto& victim = workers_[(id + k) % workers_.size()];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            auto n = victim.shared.size();
+            if (n == 0)
+                continue;
+            if (k > 0)
+                n = std::min<size_t>(std::max<size_t>(n / 2, 1), Batch);
+
+            out.insert(out.end(), victim.shared.end() - n, victim.shared.end());
+            victim.shared.resize(victim.shared.size() - n);
+            return true;
+        }
+        return false;
+    }
+
+    bool any_shared_ ()
+    {
+        for (auto& w : workers_) {
+            std::lock_guard<std::mutex> guard(w.lock);
+            if (!w.shared.empty())
+                return true;
+        }
+        return false;
+    }
+};
+
+}
+
 void GC::collect (State* state)
 {
+    auto forever = Clock::time_point::max();
+    auto start = Clock::now();
+    if (phase_ == Sweeping) {
+        sweep_until_(forever);
+        cycle_.sweep_ms += ms_since(start);
+        end_pause_(start);
+        end_cycle_();
+        start = Clock::now();
+    }
+    if (phase_ == Idle)
+        cycle_ = GCStats::Collection();
+
+    /* mark from roots. if an incremental collection was marking, this
+       rescans the roots and finishes it off */
+    mark_roots_(state);
+    mark_();
+    auto t = Clock::now();
+    cycle_.mark_ms += ms_since(start);
+
+    if (compacting_) {
+        compact_(state);
+        cycle_.compact_ms += ms_since(t);
+        t = Clock::now();
+    }
+    start_sweep_(state);
+    sweep_until_(forever);
+    cycle_.sweep_ms += ms_since(t);
+
+    end_pause_(start);
+    end_cycle_();
+}
+
+void GC::safepoint (State* state)
+{
+    if (!incremental_ && phase_ == Idle) {
+        collect(state);
+        return;
+    }
+
+    auto start = Clock::now();
+    auto deadline = start + slice_budget_;
+    bytes_since_slice_ = 0;
+    switch (phase_) {
+    case Idle:
+        cycle_ = GCStats::Collection();
+        cycle_.incremental = true;
+        phase_ = Marking;
+        mark_roots_(state);
+        /* fall through */
+
+    case Marking:
+        if (mark_until_(deadline)) {
+            /* the roots aren't covered by the write barrier, so they
+               have to be scanned again, without a break this time */
+            mark_roots_(state);
+            mark_();
+            start_sweep_(state);
+        }
+        cycle_.mark_ms += ms_since(start);
+        break;
+
+    case Sweeping:
+        sweep_until_(deadline);
+        cycle_.sweep_ms += ms_since(start);
+        break;
+    }
+
+    end_pause_(start);
+    if (phase_ == Idle)
+        end_cycle_();
+}
+
+void GC::end_pause_ (Clock::time_point start)
+{
+    auto ms = ms_since(start);
+    cycle_.slices++;
+    cycle_.max_pause_ms = std::max(cycle_.max_pause_ms, ms);
+    stats_.pauses.push_back(ms);
+    if (stats_.pauses.size() > GCStats::PausesMax)
+        stats_.pauses.pop_front();
+}
+
+void GC::end_cycle_ ()
+{
+    cycle_.live.objects = sweep_live_;
+    cycle_.live.bytes = live_bytes_;
+    cycle_.heap_bytes = cycle_.live.bytes + cycle_.freed.bytes;
+
+    stats_.collections++;
+    stats_.history.push_back(cycle_);
+    if (stats_.history.size() > GCStats::HistoryMax)
+        stats_.history.pop_front();
+}
+
+void GC::mark_roots_ (State* state)
+{
+    each_root(state, [this, state] (Cell& x) { traverse(state, x); });
 }
 
-void GC::traverse (State* state, Cell v) {
-    if (!v.is_object() || (v.obj->gc_status & GCStatus::Marked)) {
+void GC::traverse (State* state, Cell v)
+{
+    (void) state;
+    if (!v.is_object() || v.is_static() || is_marked(v.obj)) {
         /* ignore non-collectables, or already-marked objects */
         return;
     }
+    shade_(v.obj);
+}
 
-    v.obj->gc_status = Marked;
-    if (v.has_children()) {
-        for (auto& child : v.children()) {
-            traverse(state, child);
+void GC::shade_ (Object* obj)
+{
+    set_marked(obj);
+    mark_stack_.push_back(obj);
+}
+
+void GC::mark_ ()
+{
+    if (mark_threads_ > 1 && objects_.size() >= ParallelMarkMin) {
+        ParallelMarker marker(mark_threads_);
+        marker.run(mark_stack_);
+        mark_stack_.clear();
+        return;
+    }
+
+    mark_until_(std::chrono::steady_clock::time_point::max());
+}
+
+// true if marking finished, false if it ran out of time
+bool GC::mark_until_ (std::chrono::steady_clock::time_point deadline)
+{
+    /* an explicit stack, since structures may be arbitrarily deep */
+    while (!mark_stack_.empty()) {
+        // objects between looking at the clock
+        for (int i = 0; i < 256 && !mark_stack_.empty(); i++) {
+            auto obj = mark_stack_.back();
+            mark_stack_.pop_back();
+
+            each_child(obj, [this] (Object* child) {
+                if (!is_marked(child))
+                    shade_(child);
+            });
         }
+        if (std::chrono::steady_clock::now() >= deadline)
+            return mark_stack_.empty();
     }
+    return true;
+}
+
+void GC::start_sweep_ (State* state)
+{
+    /* weak references */
+    state->strings.prune();
+
+    phase_ = Sweeping;
+    sweep_pos_ = sweep_live_ = live_bytes_ = 0;
+    sweep_end_ = objects_.size();
+
+    for (auto& t : stats_.live_by_kind)
+        t = GCStats::Totals();
+    stats_.live_by_datatype.assign(std::min<size_t>(Cell::datatype_count, Cell::MaxDatatypes),
+                                  GCStats::Totals());
 }
 
+// true if sweeping finished, false if it ran out of time
+bool GC::sweep_until_ (std::chrono::steady_clock::time_point deadline)
+{
+    /* static objects here are pinned, and kept regardless */
+    while (sweep_pos_ < sweep_end_) {
+        auto end = std::min(sweep_end_, sweep_pos_ + 512);
+        for (; sweep_pos_ < end; sweep_pos_++) {
+            auto obj = objects_[sweep_pos_];
+            if (is_marked(obj) || (obj->type & Object::Static)) {
+                /* chunk marks are all cleared at the end, without
+                   touching the objects */
+                if (!(obj->gc_status & GCStatus::InChunk))
+                    obj->gc_status = 0;
+                // (nor the object list, until something dies)
+                if (sweep_live_ != sweep_pos_)
+                    objects_[sweep_live_] = obj;
+                sweep_live_++;
+                auto bytes = footprint(obj);
+                live_bytes_ += bytes;
+
+                auto& by_kind = stats_.live_by_kind[obj->kind()];
+                by_kind.objects++;
+                by_kind.bytes += bytes;
+                if (obj->kind() == Object::Instance) {
+                    auto& by_type = stats_.live_by_datatype[obj->shape];
+                    by_type.objects++;
+                    by_type.bytes += sizeof(Object) + obj->size;
+                }
+            }
+            else {
+                cycle_.freed.objects++;
+                cycle_.freed.bytes += footprint(obj);
+                /* kept in a list rather than threaded through the dead
+                   objects, which would write to their pages */
+                if (obj->gc_status & GCStatus::InChunk) {
+                    auto granules = chunk_bytes(sizeof(Object) + obj->size) / Chunk::Granule;
+                    if (granules >= free_slots_.size())
+                        free_slots_.resize(granules + 1);
+                    free_slots_[granules].push_back(obj);
+                }
+                free_object(obj);
+            }
+        }
+        if (sweep_pos_ < sweep_end_ && std::chrono::steady_clock::now() >= deadline)
+            return false;
+    }
+
+    /* keep whatever was allocated while sweeping */
+    auto young = objects_.begin() + sweep_end_;
+    objects_.erase(std::copy(young, objects_.end(), objects_.begin() + sweep_live_),
+                   objects_.end());
+    release_chunks_();
+
+    phase_ = Idle;
+    bytes_since_collect_ = 0;
+    threshold_ = std::max(MinThreshold, live_bytes_);
+    return true;
+}
+
+
+
+/*** Compaction ***/
+
+void GC::compact_ (State* state)
+{
+    /* evacuate the chunks that are mostly garbage, into new chunks */
+    for (auto chunk : chunks_)
+        chunk->live_bytes = 0;
+    for (auto obj : objects_)
+        if ((obj->gc_status & GCStatus::InChunk) && is_marked(obj))
+            Chunk::of(obj)->live_bytes += chunk_bytes(sizeof(Object) + obj->size);
+    for (auto chunk : chunks_)
+        chunk->evacuate = chunk->live_bytes < EvacuateBelow;
+    alloc_chunk_ = nullptr;
+
+    /* the interned strings are keyed by their characters, so they
+       stay put along with the static objects */
+    std::unordered_map<Object*, Object*> forward;
+    for (auto& obj : objects_) {
+        size_t bytes = sizeof(Object) + obj->size;
+        if (!is_marked(obj) || Cell(obj).is_static()
+            || Cell(obj).is_interned() || bytes >= LargeObject)
+            continue;
+        if ((obj->gc_status & GCStatus::InChunk) && !Chunk::of(obj)->evacuate)
+            continue;
+
+        auto copy = chunk_alloc_(bytes);
+        std::memcpy(copy, obj, bytes);
+        copy->gc_status = GCStatus::InChunk;
+        set_marked(copy);
+        obj->gc_status |= GCStatus::Moved;
+        forward[obj] = copy;
+        obj = copy;
+    }
+    if (forward.empty())
+        return;
+
+    /* fix up every reference to a moved object. dead objects are
+       left alone; they're about to be swept */
+    auto fix = [&forward] (Object*& obj) {
+        if (obj->gc_status & GCStatus::Moved)
+            obj = forward[obj];
+    };
+    each_root(state, [&fix] (Cell& x) {
+        if (x.is_object())
+            fix(x.obj);
+    });
+    for (auto obj : objects_) {
+        Cell v(obj);
+        if (!is_marked(obj))
+            continue;
+        if (v.has_children()) {
+            for (auto& child : v.children())
+                if (child.is_object())
+                    fix(child.obj);
+        }
+        else if (v.is_string_slice()) {
+            fix(obj->data_as_string_slice()->buffer);
+        }
+    }
+
+    /* most objects hash by address, so tables keyed by them would
+       otherwise lose their entries */
+    for (auto obj : objects_)
+        if (is_marked(obj) && Cell(obj).is_table())
+            table_rehash(obj);
+
+    for (auto& entry : forward)
+        if (!(entry.first->gc_status & GCStatus::InChunk))
+            delete[] reinterpret_cast<char*>(entry.first);
+}
+
+// frees the chunks with nothing live left in them, and clears the
+// marks in the rest
+void GC::release_chunks_ ()
+{
+    for (auto chunk : chunks_) {
+        chunk->live_bytes = 0;
+        std::memset(chunk->marks, 0, sizeof(chunk->marks));
+    }
+    for (auto obj : objects_)
+        if (obj->gc_status & GCStatus::InChunk)
+            Chunk::of(obj)->live_bytes += chunk_bytes(sizeof(Object) + obj->size);
+
+    size_t kept = 0;
+    std::vector<Chunk*> released;
+    for (auto chunk : chunks_) {
+        if (chunk->live_bytes > 0) {
+            chunks_[kept++] = chunk;
+            continue;
+        }
+        if (chunk == alloc_chunk_)
+            alloc_chunk_ = nullptr;
+        released.push_back(chunk);
+    }
+    chunks_.resize(kept);
+    if (released.empty())
+        return;
+
+    // their free space goes with them
+    std::sort(released.begin(), released.end());
+    for (auto& slots : free_slots_) {
+        slots.erase(std::remove_if(slots.begin(), slots.end(), [&released] (Object* obj) {
+            return std::binary_search(released.begin(), released.end(), Chunk::of(obj));
+        }), slots.end());
+    }
+    for (auto chunk : released)
+        unmap_chunk(chunk);
+}
 
 }
@@ -1,29 +1,237 @@
+#pragma once
 #include "Cell.h"
+#include "Stats.h"
 #include <vector>
+#include <algorithm>
+#include <chrono>
 
 namespace run {
 
 struct State;
 
+enum GCStatus {
+    // live, or grey/black while marking. only for objects that aren't
+    // InChunk (large ones, and those adopted from messages); see Chunk
+    Marked = 0x01,
+    NewlyAllocated = 0x02,
+    // allocated from a chunk rather than on its own
+    InChunk = 0x04,
+    // moved by compaction; the copy is found in the forwarding table
+    Moved = 0x08,
+};
+
+/* small objects are allocated from chunks, which are Size bytes and
+   aligned to Size, so the chunk of an object is found by masking its
+   address. the mark bits of those objects are kept in their chunk,
+   one per Granule bytes, so that neither marking nor sweeping writes
+   to the objects themselves, and a heap shared copy-on-write (with a
+   forked process, say) stays shared through a collection */
+struct Chunk
+{
+    enum { Size = 1 << 18, Granule = 8, MarkWords = Size / Granule / 64 };
+
+    uint64_t marks[MarkWords];
+    char* top;
+    char* end;
+    // as of the last collection
+    size_t live_bytes;
+    bool evacuate;
+
+    // when InChunk is set in the object's gc_status
+    static inline Chunk* of (Object* obj)
+    {
+        return reinterpret_cast<Chunk*>(uintptr_t(obj) & ~uintptr_t(Size - 1));
+    }
+
+    inline bool marked (Object* obj) const
+    {
+        auto bit = bit_(obj);
+        return (marks[bit / 64] >> (bit % 64)) & 1;
+    }
+    inline void mark (Object* obj)
+    {
+        auto bit = bit_(obj);
+        marks[bit / 64] |= uint64_t(1) << (bit % 64);
+    }
+    // true if this call is the one that marked it
+    inline bool mark_atomic (Object* obj)
+    {
+        auto bit = bit_(obj);
+        auto mask = uint64_t(1) << (bit % 64);
+        return !(__atomic_fetch_or(&marks[bit / 64], mask, __ATOMIC_RELAXED) & mask);
+    }
+
+private:
+    inline size_t bit_ (Object* obj) const
+    {
+        return (uintptr_t(obj) - uintptr_t(this)) / Granule;
+    }
+};
+
+inline bool is_marked (Object* obj)
+{
+    if (obj->gc_status & GCStatus::InChunk)
+        return Chunk::of(obj)->marked(obj);
+    return obj->gc_status & GCStatus::Marked;
+}
+
+inline void set_marked (Object* obj)
+{
+    if (obj->gc_status & GCStatus::InChunk)
+        Chunk::of(obj)->mark(obj);
+    else
+        obj->gc_status |= GCStatus::Marked;
+}
+
 struct GC
 {
-    GC ();
+    // `owner' is only needed to attribute sampled allocations
+    explicit GC (State* owner = nullptr);
+    ~GC ();
 
     Cell make_array (size_t nelems);
+    Cell make_vector (size_t capacity = 0);
+    // `capacity' is rounded up to a power of two
+    Cell make_table (size_t capacity = 0);
+    // `kind' is one of Object::Bytes, Int32s or Int64s; zero filled
+    Cell make_packed (uint8_t kind, size_t nelems);
+    // `limbs' is the magnitude, least significant first
+    Cell make_bignum (bool negative, const uint32_t* limbs, size_t count);
+    // immediate when possible, so most floats never allocate
+    Cell make_float (double d);
     Cell make_string (boost::string_ref s);
+    // appending to a string produced by concat() reuses its buffer
+    // in place as long as nothing else was appended to it first, so
+    // building a string piece by piece is amortised O(1) per character
+    Cell concat (Cell a, Cell b);
     Cell make_datatype (Cell::DatatypeFields field_names);
     Cell make_instance (Cell datatype, Cell* args);
 
+    /* objects outside of any heap, for handing from one State to
+       another (see Message). they're allocated as a heap's own are,
+       but nothing collects them until some heap adopts them */
+    static Object* alloc_detached (uint8_t type, uint32_t size);
+    // a copy of `s', with its characters in a Payload if it's large
+    static Object* detached_string (boost::string_ref s);
+    static void free_detached (Object* obj);
+    // takes over `objects', all made by alloc_detached()
+    void adopt (const std::vector<Object*>& objects);
+
+    // a whole collection, finishing any incremental one in progress
     void collect (State* state);
+    // marks `x' live, leaving its children for collect() to mark
     void traverse (State* state, Cell x);
+    // called once wants_collect(): collects, or in incremental mode
+    // does the next slice of the current collection
+    void safepoint (State* state);
+
+    /* in incremental mode, marking and sweeping are done a slice at a
+       time, each taking about `slice_budget', with the program running
+       in between. roots (registers and globals) are scanned again
+       before sweeping, but every store of a cell into an object while
+       marking must go through write_barrier() */
+    inline void set_incremental (bool on)
+    { incremental_ = on; }
+    inline void set_slice_budget (std::chrono::microseconds budget)
+    { slice_budget_ = budget; }
+
+    /* small objects are always allocated from chunks (see Chunk), the
+       space of dead ones reused for objects of the same size, and a
+       chunk's memory released once nothing in it is live. in
+       compacting mode each full collect() also moves the survivors
+       out of chunks that are mostly garbage, and out of older
+       individually allocated objects, fixing up every reference to
+       them. interned strings and static objects never move; nor does
+       anything during incremental collection */
+    inline void set_compacting (bool on)
+    { compacting_ = on; }
+
+    inline const GCStats& stats () const
+    { return stats_; }
+    // sample the running code about once per `interval' bytes
+    // allocated; zero turns sampling off
+    inline void set_alloc_sampling (size_t interval)
+    {
+        stats_.sample_interval = interval;
+        sample_countdown_ = ptrdiff_t(interval);
+    }
+
+    /* the tri-colour invariant: a marked (black) object never refers to
+       an unmarked (white) one. so anything stored into an object while
+       marking is shaded grey; new objects are allocated grey */
+    inline void write_barrier (Cell value)
+    {
+        if (phase_ == Marking && value.is_object() && !value.is_static()
+            && !is_marked(value.obj))
+            shade_(value.obj);
+    }
+
+    // threads used to mark large heaps, by default just the calling
+    // one: with a State per core, more would only compete with them.
+    // whoever knows how many States share the machine (Executor,
+    // Pool) gives each its share. the sweep is always on the calling
+    // thread
+    inline void set_mark_threads (unsigned n)
+    { mark_threads_ = std::max(1u, n); }
+
+    // true once enough has been allocated since the last collection.
+    // checked by the interpreter at its safepoints (calls and jumps),
+    // the only places a collection may happen
+    inline bool wants_collect () const
+    {
+        if (phase_ != Idle)
+            return bytes_since_slice_ >= SliceBytes;
+        return bytes_since_collect_ >= threshold_;
+    }
 
 private:
-    Cell alloc_ (uint8_t type, uint16_t size);
-};
+    enum Phase { Idle, Marking, Sweeping };
+    // bytes allocated between slices of an incremental collection
+    enum { SliceBytes = 64 << 10 };
 
-enum GCStatus {
-    Marked = 0x01,
-    NewlyAllocated = 0x02,
+    State* owner_;
+    std::vector<Object*> objects_;
+    std::vector<Object*> mark_stack_;
+    std::vector<Chunk*> chunks_;
+    Chunk* alloc_chunk_;
+    // the space of dead objects in chunks, by size in granules
+    std::vector<std::vector<Object*>> free_slots_;
+    bool compacting_;
+    size_t bytes_since_collect_;
+    size_t bytes_since_slice_;
+    size_t threshold_;
+    unsigned mark_threads_;
+
+    bool incremental_;
+    std::chrono::microseconds slice_budget_;
+    Phase phase_;
+    // sweep progress: objects_ below sweep_pos_ have been swept, and
+    // the survivors moved down to below sweep_live_. objects from
+    // sweep_end_ on were allocated since sweeping began
+    size_t sweep_pos_, sweep_live_, sweep_end_, live_bytes_;
+
+    GCStats stats_;
+    // the collection in progress
+    GCStats::Collection cycle_;
+    ptrdiff_t sample_countdown_;
+
+    Cell alloc_ (uint8_t type, uint32_t size);
+    Cell make_external_ (uint8_t type, Payload* payload);
+    void count_payload_ (size_t bytes);
+    Object* chunk_alloc_ (size_t bytes);
+    Object* reuse_slot_ (size_t bytes);
+    void sample_alloc_ ();
+    void end_pause_ (std::chrono::steady_clock::time_point start);
+    void end_cycle_ ();
+    void compact_ (State* state);
+    void release_chunks_ ();
+    void shade_ (Object* obj);
+    void mark_roots_ (State* state);
+    void mark_ ();
+    bool mark_until_ (std::chrono::steady_clock::time_point deadline);
+    void start_sweep_ (State* state);
+    bool sweep_until_ (std::chrono::steady_clock::time_point deadline);
+    Cell make_string_slice_ (Object* buffer, size_t length);
 };
 
 }
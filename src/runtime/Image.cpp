@@ -0,0 +1,56 @@
+#include "Image.h"
+#include "Pool.h"
+
+namespace run {
+
+Image::Image ()
+    : pool_workers(0)
+{
+    env.load_std_lib();
+}
+
+// here, where Pool is complete
+Image::~Image ()
+{
+}
+
+bytecode::Program& Image::add_program (std::string name, size_t argc)
+{
+    programs_.emplace_back(new bytecode::Program(argc));
+    auto& prog = *programs_.back();
+    prog.name = std::move(name);
+    return prog;
+}
+
+const bytecode::Program* Image::program (const std::string& name) const
+{
+    for (auto& prog : programs_)
+        if (prog->name == name)
+            return prog.get();
+    return nullptr;
+}
+
+Cell Image::constant (boost::string_ref s)
+{
+    auto it = constants_.find(std::string(s));
+    if (it != constants_.end())
+        return it->second;
+
+    /* not interned: interned strings are only compared by identity,
+       and each State interns its own */
+    auto str = heap_.make_string(s);
+    if (str.is_object())
+        str.obj->type |= Object::Static;
+    constants_.emplace(std::string(s), str);
+    return str;
+}
+
+Pool& Image::pool () const
+{
+    std::call_once(pool_started_, [this] {
+        pool_.reset(new Pool(*this, pool_workers));
+    });
+    return *pool_;
+}
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include "State.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace run {
+
+class Pool;
+
+/* code and constants built once and shared, read-only, by every
+   State made from the image (see State::State(const Image&)), so
+   that another State costs little more than its own heap.
+
+   the image's environment holds the standard library and whatever
+   functions are defined for its programs; States share its functions
+   and start out with a copy of its symbols and globals. globals in
+   the image may only hold immediates, datatypes and constants made
+   by constant(). inline caches and everything else that changes as
+   code runs belong to each State.
+
+   all of it must be set up before the first State is made, and left
+   alone while any exist */
+struct Image
+{
+    Image ();
+    ~Image ();
+
+    Environment env;
+    // workers for pool(); 0 for one per core
+    unsigned pool_workers;
+
+    // a program owned by the image
+    bytecode::Program& add_program (std::string name, size_t argc);
+    // null if there's no program by that name
+    const bytecode::Program* program (const std::string& name) const;
+
+    // a string that is never collected or moved, for programs'
+    // constants; the same one for the same contents
+    Cell constant (boost::string_ref s);
+
+    // isolates made from the image for running work in parallel,
+    // started on first use, from any thread; see Pool
+    Pool& pool () const;
+
+private:
+    // holds the constants; it is never collected, and everything in
+    // it is static as far as the States' collectors are concerned
+    GC heap_;
+    std::unordered_map<std::string, Cell> constants_;
+    std::vector<std::unique_ptr<bytecode::Program>> programs_;
+
+    // last, so that the workers stop before anything they use is gone
+    mutable std::once_flag pool_started_;
+    mutable std::unique_ptr<Pool> pool_;
+};
+
+}
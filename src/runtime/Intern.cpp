@@ -0,0 +1,39 @@
+#include "Intern.h"
+#include "GC.h"
+#include <boost/functional/hash.hpp>
+
+namespace run {
+
+size_t InternTable::Hash::operator() (boost::string_ref s) const
+{
+    return boost::hash_range(s.begin(), s.end());
+}
+
+Cell InternTable::intern (GC& gc, boost::string_ref s)
+{
+    /* small strings are already unique by value */
+    if (s.size() <= Cell::SmallStringMax)
+        return Cell::small_string(s);
+
+    auto map_iter = table_.find(s);
+    if (map_iter != table_.end())
+        return map_iter->second;
+
+    auto str = gc.make_string(s);
+    str.obj->type |= Object::Interned;
+    table_[str.string()] = str.obj;
+    return str;
+}
+
+void InternTable::prune ()
+{
+    for (auto it = table_.begin(); it != table_.end(); ) {
+        auto obj = it->second;
+        if (is_marked(obj) || (obj->type & Object::Static))
+            ++it;
+        else
+            it = table_.erase(it);
+    }
+}
+
+}
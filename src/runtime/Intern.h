@@ -0,0 +1,33 @@
+#pragma once
+#include "Cell.h"
+#include <unordered_map>
+
+namespace run {
+
+struct GC;
+
+/* table of interned strings. there is at most one interned string
+   object with any given contents, so two interned strings are equal
+   exactly when they are the same object. the table does not keep its
+   strings alive; the collector calls prune() after marking to drop
+   entries that nothing else refers to. */
+struct InternTable
+{
+    Cell intern (GC& gc, boost::string_ref s);
+
+    // forget every string that was not marked by the collector
+    void prune ();
+
+    inline size_t size () const
+    { return table_.size(); }
+
+private:
+    struct Hash
+    {
+        size_t operator() (boost::string_ref s) const;
+    };
+    // keys point into the string objects themselves
+    std::unordered_map<boost::string_ref, Object*, Hash> table_;
+};
+
+}
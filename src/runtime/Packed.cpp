@@ -0,0 +1,274 @@
+#include "Packed.h"
+#include "Bignum.h"
+#include "GC.h"
+#include <boost/format.hpp>
+#include <algorithm>
+
+namespace run {
+
+namespace {
+
+/* the bulk operations are written against GCC's generic vectors,
+   which are lowered to whatever the target has (SSE2 at least on
+   x86-64). plain loops over the elements aren't reliably vectorised
+   at -O2, reductions especially */
+template <typename T, size_t Bytes = 16>
+struct Vec
+{
+    typedef T type __attribute__((vector_size(Bytes)));
+    enum { Lanes = Bytes / sizeof(T) };
+
+    static inline type load (const T* p)
+    {
+        type v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+};
+
+const char* kind_name (Cell a)
+{
+    switch (a.obj->kind()) {
+    case Object::Int32s: return "int32s";
+    case Object::Int64s: return "int64s";
+    default:             return "bytes";
+    }
+}
+
+void check_range (Cell a, Fixnum i, Fixnum count = 1)
+{
+    auto len = Fixnum(a.packed_length());
+    if (i < 0 || count < 0 || i > len - count) {
+        auto fmt = boost::format
+            ("index %d out of range for %s of length %d")
+            % i % kind_name(a) % len;
+        throw std::runtime_error(fmt.str());
+    }
+}
+
+// false if `x' isn't an integer that fits an element of `a'
+bool to_elem (Cell a, Cell x, int64_t& out)
+{
+    if (!bignum::to_int64(x, out))
+        return false;
+    switch (a.obj->kind()) {
+    case Object::Bytes:  return 0 <= out && out <= UINT8_MAX;
+    case Object::Int32s: return INT32_MIN <= out && out <= INT32_MAX;
+    default:             return true;
+    }
+}
+
+int64_t to_elem_or_throw (Cell a, Cell x)
+{
+    int64_t e;
+    if (!to_elem(a, x, e)) {
+        auto fmt = boost::format
+            ("value doesn't fit an element of %s") % kind_name(a);
+        throw std::runtime_error(fmt.str());
+    }
+    return e;
+}
+
+template <typename T>
+inline T* elems (Cell a)
+{
+    return reinterpret_cast<T*>(a.obj->contents());
+}
+
+
+/* sums */
+
+uint64_t sum_bytes (const uint8_t* xs, size_t n)
+{
+    typedef Vec<uint8_t> V8;
+    typedef Vec<uint32_t, 64> V32;
+    // each 32-bit lane takes at most Block / Lanes bytes per block,
+    // which can't overflow it
+    const size_t Block = size_t(1) << 20;
+
+    uint64_t total = 0;
+    size_t i = 0;
+    while (n - i >= V8::Lanes) {
+        V32::type acc = {};
+        size_t end = std::min(n, i + Block);
+        for (; i + V8::Lanes <= end; i += V8::Lanes)
+            acc += __builtin_convertvector(V8::load(xs + i), V32::type);
+        for (size_t l = 0; l < V32::Lanes; l++)
+            total += acc[l];
+    }
+    for (; i < n; i++)
+        total += xs[i];
+    return total;
+}
+
+int64_t sum_int32s (const int32_t* xs, size_t n)
+{
+    typedef Vec<int32_t> V32;
+    typedef Vec<int64_t, 32> V64;
+    // packed arrays are under 4 GiB, so int64 lanes can't overflow
+
+    V64::type acc = {};
+    size_t i = 0;
+    for (; i + V32::Lanes <= n; i += V32::Lanes)
+        acc += __builtin_convertvector(V32::load(xs + i), V64::type);
+
+    int64_t total = 0;
+    for (size_t l = 0; l < V64::Lanes; l++)
+        total += acc[l];
+    for (; i < n; i++)
+        total += xs[i];
+    return total;
+}
+
+__int128 sum_int64s (const int64_t* xs, size_t n)
+{
+    typedef Vec<int64_t> V64;
+    typedef Vec<uint64_t> U64;
+    /* the low and high halves of each element are summed separately,
+       which can't overflow for fewer than 2^31 elements, and combined
+       at the end */
+
+    V64::type hi = {};
+    U64::type lo = {};
+    size_t i = 0;
+    for (; i + V64::Lanes <= n; i += V64::Lanes) {
+        auto v = V64::load(xs + i);
+        hi += v >> 32;
+        lo += U64::type(v) & 0xffffffff;
+    }
+
+    __int128 total = 0;
+    for (size_t l = 0; l < V64::Lanes; l++)
+        total += __int128(hi[l]) * (int64_t(1) << 32) + lo[l];
+    for (; i < n; i++)
+        total += xs[i];
+    return total;
+}
+
+
+/* searching */
+
+template <typename T>
+Fixnum find_elem (const T* xs, size_t n, T x)
+{
+    typedef Vec<T> V;
+    const auto needle = typename V::type{} + x;
+
+    /* skip ahead a vector at a time until some lane matches; the
+       comparison gives -1 in matching lanes and 0 elsewhere */
+    size_t i = 0;
+    for (; i + V::Lanes <= n; i += V::Lanes) {
+        auto eq = V::load(xs + i) == needle;
+        uint64_t halves[2];
+        std::memcpy(halves, &eq, sizeof(halves));
+        if (halves[0] | halves[1])
+            break;
+    }
+    for (; i < n; i++)
+        if (xs[i] == x)
+            return Fixnum(i);
+    return -1;
+}
+
+}
+
+
+
+Cell packed_get (GC& gc, Cell a, Fixnum i)
+{
+    check_range(a, i);
+    switch (a.obj->kind()) {
+    case Object::Bytes:
+        return Cell::from_fixnum(elems<uint8_t>(a)[i]);
+    case Object::Int32s:
+        return Cell::from_fixnum(elems<int32_t>(a)[i]);
+    default:
+        return bignum::from_int128(gc, elems<int64_t>(a)[i]);
+    }
+}
+
+void packed_set (Cell a, Fixnum i, Cell x)
+{
+    check_range(a, i);
+    auto e = to_elem_or_throw(a, x);
+    switch (a.obj->kind()) {
+    case Object::Bytes:  elems<uint8_t>(a)[i] = uint8_t(e); break;
+    case Object::Int32s: elems<int32_t>(a)[i] = int32_t(e); break;
+    default:             elems<int64_t>(a)[i] = e; break;
+    }
+}
+
+void packed_fill (Cell a, Cell x)
+{
+    auto e = to_elem_or_throw(a, x);
+    auto n = a.packed_length();
+    // (contents are null once moved away)
+    if (n == 0)
+        return;
+    switch (a.obj->kind()) {
+    case Object::Bytes:
+        std::memset(a.obj->contents(), int(e), n);
+        break;
+    case Object::Int32s:
+        std::fill_n(elems<int32_t>(a), n, int32_t(e));
+        break;
+    default:
+        std::fill_n(elems<int64_t>(a), n, e);
+        break;
+    }
+}
+
+void packed_copy (Cell dst, Fixnum dst_start,
+                  Cell src, Fixnum src_start, Fixnum count)
+{
+    if (dst.obj->kind() != src.obj->kind()) {
+        auto fmt = boost::format("can't copy from %s to %s")
+            % kind_name(src) % kind_name(dst);
+        throw std::runtime_error(fmt.str());
+    }
+    check_range(dst, dst_start, count);
+    check_range(src, src_start, count);
+    if (count == 0)
+        return;
+
+    auto elem = dst.obj->packed_elem_size();
+    std::memmove(dst.obj->contents() + dst_start * elem,
+                 src.obj->contents() + src_start * elem,
+                 count * elem);
+}
+
+Cell packed_sum (GC& gc, Cell a)
+{
+    auto n = a.packed_length();
+    switch (a.obj->kind()) {
+    case Object::Bytes:
+        return bignum::from_int128(gc, sum_bytes(elems<uint8_t>(a), n));
+    case Object::Int32s:
+        return bignum::from_int128(gc, sum_int32s(elems<int32_t>(a), n));
+    default:
+        return bignum::from_int128(gc, sum_int64s(elems<int64_t>(a), n));
+    }
+}
+
+Fixnum packed_find (Cell a, Cell x)
+{
+    int64_t e;
+    if (!to_elem(a, x, e))
+        return -1;
+
+    auto n = a.packed_length();
+    if (n == 0)
+        return -1;
+    switch (a.obj->kind()) {
+    case Object::Bytes: {
+        auto p = std::memchr(a.obj->contents(), int(e), n);
+        return p ? Fixnum(static_cast<const char*>(p) - a.obj->contents()) : -1;
+    }
+    case Object::Int32s:
+        return find_elem(elems<int32_t>(a), n, int32_t(e));
+    default:
+        return find_elem(elems<int64_t>(a), n, e);
+    }
+}
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include "Cell.h"
+
+namespace run {
+
+struct GC;
+
+/* operations on the packed arrays made by GC::make_packed(). elements
+   are stored raw (uint8_t, int32_t or int64_t) rather than as cells, so
+   they take 1/8 to 1 of the space of an array and the bulk operations
+   below can run over them a vector register at a time. */
+
+// throw if `i' is out of range, or if `x' doesn't fit the element type
+Cell packed_get (GC& gc, Cell a, Fixnum i);
+void packed_set (Cell a, Fixnum i, Cell x);
+
+// store `x' into every element
+void packed_fill (Cell a, Cell x);
+// copy `count' elements from `src' starting at `src_start' into `dst'
+// starting at `dst_start'. both must be the same kind of packed array,
+// and may be the same array with overlapping ranges
+void packed_copy (Cell dst, Fixnum dst_start,
+                  Cell src, Fixnum src_start, Fixnum count);
+// never overflows; promotes to a bignum if need be
+Cell packed_sum (GC& gc, Cell a);
+// index of the first element equal to `x', or -1
+Fixnum packed_find (Cell a, Cell x);
+
+}
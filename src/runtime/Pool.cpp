@@ -0,0 +1,140 @@
+#include "Pool.h"
+#include "Image.h"
+#include <algorithm>
+
+namespace run {
+
+namespace {
+// set on the threads of pools
+thread_local bool in_pool = false;
+}
+
+Pool::Pool (const Image& image, unsigned workers)
+    : image_(image)
+    , next_(0)
+    , queued_(0)
+    , stopping_(false)
+{
+    if (workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i = 0; i < workers; i++)
+        workers_.emplace_back(new Worker);
+
+    // every deque exists before anyone can try to steal from it
+    for (size_t i = 0; i < workers_.size(); i++)
+        workers_[i]->thread = std::thread(&Pool::work_, this, i);
+}
+
+Pool::~Pool ()
+{
+    {
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& w : workers_)
+        w->thread.join();
+}
+
+bool Pool::on_worker ()
+{
+    return in_pool;
+}
+
+void Pool::run (size_t n, const std::function<void (State&, size_t)>& task)
+{
+    if (n == 0)
+        return;
+
+    Batch batch;
+    batch.task = &task;
+    batch.remaining = n;
+
+    /* counted before they're visible, so that the count never drops
+       below zero; a worker woken early just looks again */
+    {
+        std::lock_guard<std::mutex> guard(idle_lock_);
+        queued_ += n;
+    }
+    size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+    for (size_t i = 0; i < n; i++) {
+        auto& w = *workers_[(start + i) % workers_.size()];
+        std::lock_guard<std::mutex> guard(w.lock);
+        w.tasks.push_back(Task { &batch, i });
+    }
+    wake_.notify_all();
+
+    std::unique_lock<std::mutex> guard(batch.lock);
+    batch.done.wait(guard, [&] { return batch.remaining == 0; });
+    if (batch.error)
+        std::rethrow_exception(batch.error);
+}
+
+void Pool::work_ (size_t self)
+{
+    in_pool = true;
+    State state(image_);
+    unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+    state.gc.set_mark_threads(cores / unsigned(workers_.size()));
+
+    for (;;) {
+        Task task;
+        if (!take_(self, task)) {
+            std::unique_lock<std::mutex> guard(idle_lock_);
+            wake_.wait(guard, [this] { return stopping_ || queued_ > 0; });
+            if (stopping_)
+                return;
+            continue;
+        }
+
+        std::exception_ptr error;
+        try {
+            (*task.batch->task)(state, task.index);
+        }
+        catch (...) {
+            error = std::current_exception();
+        }
+        finish_(*task.batch, error);
+
+        // nothing is rooted between tasks
+        if (state.gc.wants_collect())
+            state.gc.safepoint(&state);
+    }
+}
+
+bool Pool::take_ (size_t self, Task& task)
+{
+    size_t n = workers_.size();
+    for (size_t k = 0; k < n; k++) {
+        auto& w = *workers_[(self + k) % n];
+        std::lock_guard<std::mutex> guard(w.lock);
+        if (w.tasks.empty())
+            continue;
+
+        // our own newest task, or someone else's oldest
+        if (k == 0) {
+            task = w.tasks.back();
+            w.tasks.pop_back();
+        }
+        else {
+            task = w.tasks.front();
+            w.tasks.pop_front();
+        }
+        queued_--;
+        return true;
+    }
+    return false;
+}
+
+void Pool::finish_ (Batch& batch, std::exception_ptr error)
+{
+    /* notified under the lock: once `remaining' is zero, run() may
+       return and take the batch with it */
+    std::lock_guard<std::mutex> guard(batch.lock);
+    if (error && !batch.error)
+        batch.error = error;
+    if (--batch.remaining == 0)
+        batch.done.notify_one();
+}
+
+}
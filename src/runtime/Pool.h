@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace run {
+
+struct State;
+struct Image;
+
+/* worker threads, each with an isolate made from the same image, that
+   run the tasks of a batch between them. every worker has a deque of
+   tasks of its own: it takes from the back of it, and once it runs
+   dry, steals from the front of the others', so that a batch whose
+   tasks take uneven time still keeps every worker busy.
+
+   tasks see only their worker's State, so anything they're given or
+   give back has to be sent as a Message. see Image::pool() for the
+   pool of an image */
+class Pool
+{
+public:
+    // `workers' of 0 for one per core
+    explicit Pool (const Image& image, unsigned workers = 0);
+    ~Pool ();
+    Pool (const Pool&) = delete;
+    Pool& operator= (const Pool&) = delete;
+
+    // runs task(state, i) on the workers for every i below n, and waits
+    // for all of them. if any throw, the first error is rethrown once
+    // the rest are done. must not be called from a worker, which
+    // would wait on itself
+    void run (size_t n, const std::function<void (State&, size_t)>& task);
+
+    inline unsigned workers () const
+    { return unsigned(workers_.size()); }
+
+    // true on the threads of any pool
+    static bool on_worker ();
+
+private:
+    struct Batch
+    {
+        const std::function<void (State&, size_t)>* task;
+        std::mutex lock;
+        std::condition_variable done;
+        size_t remaining;
+        std::exception_ptr error;
+    };
+
+    struct Task
+    {
+        Batch* batch;
+        size_t index;
+    };
+
+    struct Worker
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    const Image& image_;
+    std::vector<std::unique_ptr<Worker>> workers_;
+    // where run() starts handing out tasks, so that small batches
+    // don't all land on the first worker
+    std::atomic<size_t> next_;
+
+    // for sleeping while there's nothing to take
+    std::mutex idle_lock_;
+    std::condition_variable wake_;
+    // tasks in the deques; only ever raised under idle_lock_
+    std::atomic<size_t> queued_;
+    bool stopping_;
+
+    void work_ (size_t self);
+    bool take_ (size_t self, Task& task);
+    void finish_ (Batch& batch, std::exception_ptr error);
+};
+
+}
@@ -0,0 +1,141 @@
+#include "Profiler.h"
+#include "State.h"
+#include "../bytecode/Program.h"
+#include <sys/time.h>
+#include <boost/format.hpp>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace run {
+
+std::atomic<int> profile_tick(0);
+
+namespace {
+
+std::atomic<Profiler*> active(nullptr);
+// threads between finding the active profiler and being done with it
+std::atomic<int> sampling(0);
+
+struct SamplingGuard
+{
+    SamplingGuard () { sampling++; }
+    ~SamplingGuard () { sampling--; }
+};
+
+void on_sigprof (int)
+{
+    profile_tick = 1;
+}
+
+void set_timer (unsigned hz)
+{
+    struct itimerval timer = {};
+    if (hz > 0) {
+        timer.it_interval.tv_usec = long(1000000 / hz);
+        timer.it_value = timer.it_interval;
+    }
+    setitimer(ITIMER_PROF, &timer, nullptr);
+}
+
+}
+
+Profiler::Profiler ()
+    : running_(false)
+    , samples_(0)
+{
+}
+
+Profiler::~Profiler ()
+{
+    stop();
+}
+
+void Profiler::start (unsigned hz)
+{
+    if (running_)
+        return;
+    if (hz == 0 || hz > 1000000) {
+        auto fmt = boost::format("bad profiling rate %u Hz") % hz;
+        throw std::runtime_error(fmt.str());
+    }
+    Profiler* none = nullptr;
+    if (!active.compare_exchange_strong(none, this))
+        throw std::runtime_error("another profiler is already running");
+
+    struct sigaction action = {};
+    action.sa_handler = on_sigprof;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, &old_action_);
+
+    running_ = true;
+    profile_tick = 0;
+    set_timer(hz);
+}
+
+void Profiler::stop ()
+{
+    if (!running_)
+        return;
+
+    set_timer(0);
+    sigaction(SIGPROF, &old_action_, nullptr);
+    profile_tick = 0;
+    running_ = false;
+
+    /* a thread counts itself in before it looks for the profiler, so
+       once this is cleared, any that might still be using it show up
+       in the count */
+    active = nullptr;
+    while (sampling.load() > 0)
+        std::this_thread::yield();
+}
+
+void Profiler::tick (State* state, int ip)
+{
+    // one sample per tick, however many States noticed it
+    if (profile_tick.exchange(0) == 0)
+        return;
+    SamplingGuard guard;
+    if (auto profiler = active.load())
+        profiler->sample_(state, ip);
+}
+
+void Profiler::sample_ (State* state, int ip)
+{
+    /* the innermost activation's ip is only kept across calls, so it
+       is passed in; the rest are all stopped at a call */
+    std::vector<const Coroutine*> chain;
+    for (auto co = state->current_coroutine; co != nullptr; co = co->caller)
+        chain.push_back(co);
+
+    std::string stack;
+    for (size_t i = chain.size(); i-- > 0; ) {
+        auto& frames = chain[i]->frames;
+        for (size_t j = 0; j < frames.size(); j++) {
+            auto& act = frames[j];
+            if (!stack.empty())
+                stack += ';';
+            stack += act.program->name.empty() ? "<anonymous>" : act.program->name;
+            stack += '@';
+            bool innermost = (i == 0 && j + 1 == frames.size());
+            stack += std::to_string(innermost ? ip : act.ip - 1);
+        }
+    }
+    if (stack.empty())
+        stack = "<native>";
+
+    std::lock_guard<std::mutex> guard(lock_);
+    stacks_[stack]++;
+    samples_++;
+}
+
+void Profiler::write_folded (std::ostream& out) const
+{
+    std::lock_guard<std::mutex> guard(lock_);
+    for (auto& entry : stacks_)
+        out << entry.first << ' ' << entry.second << '\n';
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <csignal>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace run {
+
+struct State;
+
+// raised by the profiling timer, from whichever thread the signal
+// lands on, and cleared by the first State to notice; see Profiler
+extern std::atomic<int> profile_tick;
+
+/* sampling profiler for bytecode programs. a SIGPROF timer raises
+   profile_tick, and the next safepoint the interpreter reaches (a
+   call or a jump) records the stack of running programs. nothing is
+   done in the signal handler itself, and while no profiler runs the
+   cost is one flag test per safepoint.
+
+   time spent in native functions is charged to the call that the
+   program was making. only one profiler may run at a time, since the
+   timer is process-wide. each tick is one sample, of whichever State
+   reaches a safepoint first, so with several States running on
+   threads the samples are shared among them rather than each being
+   sampled at the full rate */
+struct Profiler
+{
+    Profiler ();
+    ~Profiler ();
+
+    void start (unsigned hz = 997);
+    // waits for samples being taken on other threads to finish
+    void stop ();
+    inline bool running () const
+    { return running_; }
+
+    // called by the interpreter once profile_tick is raised; `ip' is
+    // the index of the instruction about to run in the current
+    // coroutine's innermost activation
+    static void tick (State* state, int ip);
+
+    // stacks as lines of "main@4;fib@9 123", for flamegraph.pl and
+    // similar tools
+    void write_folded (std::ostream& out) const;
+
+    size_t samples () const
+    { return samples_; }
+
+private:
+    bool running_;
+    mutable std::mutex lock_;
+    size_t samples_;
+    // sample counts by folded stack
+    std::map<std::string, size_t> stacks_;
+    struct sigaction old_action_;
+
+    void sample_ (State* state, int ip);
+};
+
+}
@@ -1,40 +1,219 @@
 #include "State.h"
+#include "Image.h"
+#include <algorithm>
+#include <boost/format.hpp>
 
 namespace run {
 
 Environment::Environment ()
+    : image_(nullptr)
 {
 }
 
+Environment::Environment (const Image& image)
+    : symbols(image.env.symbols)
+    , functions(image.env.functions)
+    , globals(image.env.globals)
+    , image_(&image.env)
+{
+}
+
+
+Symbol Environment::intern (const std::string& name)
+{
+    auto sym = symbols.intern(name);
+    if (sym >= functions.size()) {
+        functions.resize(symbols.size(), nullptr);
+        globals.resize(symbols.size(), Cell::nil());
+    }
+    return sym;
+}
 
 Function* Environment::get_function (const std::string& name,
                                      bool create_if_not_found)
 {
-    auto map_iter = functions.find(name);
-    if (map_iter == functions.end()) {
-        if (create_if_not_found) {
-            auto fn = new Function(name);
-            functions[name] = std::unique_ptr<Function>(fn);
-            return fn;
-        }
-        else
+    Symbol sym;
+    if (!symbols.find(name, sym)) {
+        if (!create_if_not_found)
             return nullptr;
+        sym = intern(name);
     }
 
-    return map_iter->second.get();
+    auto& fn = functions[sym];
+    if (!fn && create_if_not_found) {
+        owned_.emplace_back(new Function(name));
+        fn = owned_.back().get();
+    }
+
+    return fn;
 }
 
-FunctionImpl& Environment::impl_function (const std::string& name, size_t argc)
+FunctionImpl& Environment::impl_function (const std::string& name, FunctionImpl impl)
 {
     auto fn = get_function(name, true);
-    fn->implementations.emplace_back(argc);
-    return fn->implementations.back();
+    if (image_ && std::count(image_->functions.begin(), image_->functions.end(), fn)) {
+        auto fmt = boost::format("cannot change function `%s' of a shared image") % name;
+        throw std::runtime_error(fmt.str());
+    }
+    return fn->add_impl(std::move(impl));
+}
+
+
+Frame::Frame (State* st, Cell* r, size_t n, Cell* a)
+    : state(st)
+    , parent(st->frame)
+    , regs(r)
+    , reg_count(n)
+    , acc(a)
+{
+    state->frame = this;
+}
+
+Frame::~Frame ()
+{
+    state->frame = parent;
 }
 
 
 State::State ()
+    : gc(this)
+    , image(nullptr)
+    , frame(nullptr)
+    , current_coroutine(nullptr)
+    , coroutines(nullptr)
 {
     env.load_std_lib();
 }
 
+State::State (const Image& image)
+    : env(image)
+    , gc(this)
+    , image(&image)
+    , frame(nullptr)
+    , current_coroutine(nullptr)
+    , coroutines(nullptr)
+{
+}
+
+Cell State::intern_constant (boost::string_ref s)
+{
+    auto str = intern(s);
+    if (str.is_object())
+        str.obj->type |= Object::Static;
+    return str;
+}
+
+bytecode::FieldCache* State::field_caches (const bytecode::Program& prog)
+{
+    /* a program's ids are reused once it's gone, so the serial number
+       tells whether these caches were made for this one */
+    if (prog.id() >= caches_.size())
+        caches_.resize(prog.id() + 1);
+    auto& c = caches_[prog.id()];
+    if (c.serial != prog.serial()) {
+        c.serial = prog.serial();
+        c.fields.assign(prog.field_sites.size(), bytecode::FieldCache());
+    }
+    else if (c.fields.size() < prog.field_sites.size()) {
+        c.fields.resize(prog.field_sites.size());
+    }
+    // moving caches_ around doesn't move the elements of `fields'
+    return c.fields.data();
+}
+
+
+std::shared_ptr<Coroutine> State::spawn (Function* fn, Cell* args, size_t argc)
+{
+    auto impl = fn->dispatch(args, argc);
+    if (impl == nullptr) {
+        auto fmt = boost::format
+            ("no implementation of function `%s' matches the given %d argument(s)")
+            % fn->name % argc;
+        throw std::runtime_error(fmt.str());
+    }
+    if (impl->program == nullptr) {
+        auto fmt = boost::format("cannot spawn native function `%s'") % fn->name;
+        throw std::runtime_error(fmt.str());
+    }
+
+    auto co = std::make_shared<Coroutine>(this);
+    co->enter(impl->program, args);
+    co->scheduled = true;
+    ready_.push_back(co);
+    return co;
+}
+
+void State::run_coroutines ()
+{
+    if (current_coroutine)
+        throw std::runtime_error("cannot run coroutines from inside one");
+
+    while (!ready_.empty()) {
+        auto co = std::move(ready_.front());
+        ready_.pop_front();
+        try {
+            bytecode::interpret(this, *co);
+        }
+        catch (std::exception& e) {
+            co->status = Coroutine::Failed;
+            co->error = e.what();
+            co->frames.clear();
+            co->top = 0;
+        }
+    }
+}
+
+void State::drop_coroutines ()
+{
+    ready_.clear();
+}
+
+std::shared_ptr<Coroutine> State::suspend ()
+{
+    auto co = current_coroutine;
+    if (co == nullptr || !co->scheduled)
+        throw std::runtime_error("cannot suspend outside of a spawned coroutine");
+    co->suspending = true;
+    return co->shared_from_this();
+}
+
+void State::wake (std::shared_ptr<Coroutine> co, Cell value)
+{
+    /* it may still be running the function that suspended it */
+    bool stopping = co->status == Coroutine::Running && co->suspending;
+    if (co->status != Coroutine::Suspended && !stopping)
+        throw std::runtime_error("cannot wake a coroutine that isn't suspended");
+    co->status = Coroutine::Ready;
+    co->acc = value;
+    ready_.push_back(std::move(co));
+}
+
+void State::yield ()
+{
+    wake(suspend(), Cell::nil());
+}
+
+std::unique_ptr<Coroutine> State::take_coroutine ()
+{
+    if (spare_.empty())
+        return std::unique_ptr<Coroutine>(new Coroutine(this));
+    auto co = std::move(spare_.back());
+    spare_.pop_back();
+    return co;
+}
+
+void State::give_coroutine (std::unique_ptr<Coroutine> co)
+{
+    /* only as many as are ever nested, which is usually few */
+    if (spare_.size() >= MaxSpareCoroutines)
+        return;
+    co->status = Coroutine::Ready;
+    co->frames.clear();
+    co->top = 0;
+    co->acc = co->result = Cell::nil();
+    co->error.clear();
+    co->suspending = co->return_on_resume = false;
+    spare_.push_back(std::move(co));
+}
+
 }
@@ -1,36 +1,151 @@
 #pragma once
-#include <unordered_map>
+#include <deque>
 #include <memory>
 #include "Cell.h"
 
+#include "Symbol.h"
 #include "Function.h"
 #include "GC.h"
+#include "Intern.h"
+#include "Coroutine.h"
+
+#include "../bytecode/Program.h"
 
 namespace run {
 
+struct Image;
+
 struct Environment
 {
     Environment ();
+    // the same symbols as the image's environment, sharing its
+    // functions, and with a copy of its globals
+    explicit Environment (const Image& image);
+    // not copyable, since it owns its functions
+    Environment (const Environment&) = delete;
+    Environment& operator= (const Environment&) = delete;
+
+    SymbolTable symbols;
 
-    std::unordered_map<std::string,
-                       std::unique_ptr<Function>> functions;
+    // both tables are indexed by Symbol, and grow whenever
+    // a new symbol is interned through intern(). functions are
+    // owned by this environment, or shared with the one it was
+    // made from, in which case they can't be changed
+    std::vector<Function*> functions;
+    std::vector<Cell> globals;
 
     void load_std_lib ();
 
+    Symbol intern (const std::string& name);
+
     Function* get_function (const std::string& name,
                             bool create_if_not_found = false);
+    inline Function* get_function (Symbol sym) const
+    { return functions[sym]; }
+
+    FunctionImpl& impl_function (const std::string& name, FunctionImpl impl);
+
+    // slot for the global named by `sym'; null if never assigned
+    inline Cell& global (Symbol sym)
+    { return globals[sym]; }
 
-    FunctionImpl& impl_function (const std::string& name, size_t argc);
+private:
+    std::vector<std::unique_ptr<Function>> owned_;
+    // where shared functions come from
+    const Environment* image_;
 };
 
 
 
+struct State;
+
+/* cells kept by native code, linked into the state for as long as
+   the frame exists so that the collector can find them. bytecode
+   keeps its registers in a Coroutine instead */
+struct Frame
+{
+    Frame (State* state, Cell* regs, size_t reg_count, Cell* acc);
+    ~Frame ();
+
+    State* state;
+    Frame* parent;
+    Cell* regs;
+    size_t reg_count;
+    Cell* acc;
+};
+
+
+/* an isolate: a heap, an environment and interned strings of its own.
+   a State must only be used by one thread at a time, but separate
+   States share nothing that changes (the built-in datatypes are
+   immutable, the datatype table hands out ids atomically, and an
+   Image is read-only), so each may run on a thread of its own */
 struct State
 {
     State ();
+    // made from an image, which must outlive the State; see Image
+    explicit State (const Image& image);
 
     Environment env;
     GC gc;
+    InternTable strings;
+    // the image this State was made from, if any
+    const Image* image;
+
+    // innermost native frame
+    Frame* frame;
+    // the coroutine whose code is running, if any
+    Coroutine* current_coroutine;
+    // every live coroutine, linked through Coroutine::next()
+    Coroutine* coroutines;
+
+    // strings with the same contents are interned to the same object
+    inline Cell intern (boost::string_ref s)
+    { return strings.intern(gc, s); }
+
+    // like intern(), but the string is never collected; for constants
+    // referred to by code
+    Cell intern_constant (boost::string_ref s);
+
+    // this State's inline caches for `prog', which has field sites
+    bytecode::FieldCache* field_caches (const bytecode::Program& prog);
+
+    /* the scheduler. coroutines made by spawn() take turns running on
+       the calling thread whenever run_coroutines() is called, each
+       until it finishes or suspends. a suspended coroutine is only
+       kept by whoever is going to wake it */
+
+    // a coroutine that will call `fn' with a copy of `args', which
+    // must have a bytecode implementation matching them
+    std::shared_ptr<Coroutine> spawn (Function* fn, Cell* args, size_t argc);
+    // runs coroutines until none are ready; those that fail are left
+    // with their error
+    void run_coroutines ();
+    // forgets the coroutines that are ready, without running them;
+    // for throwing away what a failed piece of work left behind
+    void drop_coroutines ();
+    // called by a native function to stop the coroutine running it
+    // once it returns. the function's result is ignored; the call
+    // returns whatever the coroutine is woken with
+    std::shared_ptr<Coroutine> suspend ();
+    // makes a suspended coroutine ready again
+    void wake (std::shared_ptr<Coroutine> co, Cell value);
+    // lets the other ready coroutines run before this one carries on
+    void yield ();
+
+    // a coroutine to run something to completion in, for
+    // Program::execute(); reused, so that calling into bytecode from
+    // native code doesn't allocate each time. give it back after
+    std::unique_ptr<Coroutine> take_coroutine ();
+    void give_coroutine (std::unique_ptr<Coroutine> co);
+
+private:
+    enum { MaxSpareCoroutines = 64 };
+
+    // by Program::id()
+    std::vector<bytecode::ProgramCaches> caches_;
+    std::deque<std::shared_ptr<Coroutine>> ready_;
+    std::vector<std::unique_ptr<Coroutine>> spare_;
 };
 
 
@@ -0,0 +1,106 @@
+#include "Stats.h"
+#include <boost/format.hpp>
+
+namespace run {
+
+GCStats::GCStats ()
+    : collections(0)
+    , sample_interval(0)
+{
+}
+
+
+namespace {
+
+void write_string (std::ostream& out, boost::string_ref s)
+{
+    out << '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\')
+            out << '\\' << c;
+        else if (uint8_t(c) < 0x20)
+            out << boost::format("\\u%04x") % int(c);
+        else
+            out << c;
+    }
+    out << '"';
+}
+
+void write_totals (std::ostream& out, const GCStats::Totals& t)
+{
+    out << "{\"objects\": " << t.objects << ", \"bytes\": " << t.bytes << "}";
+}
+
+}
+
+void write_json (std::ostream& out, const GCStats& stats)
+{
+    out << "{\n  \"allocated\": ";
+    write_totals(out, stats.allocated);
+    out << ",\n  \"collections\": " << stats.collections;
+
+    out << ",\n  \"history\": [";
+    const char* sep = "\n    ";
+    for (auto& c : stats.history) {
+        out << sep << "{\"incremental\": " << (c.incremental ? "true" : "false")
+            << ", \"slices\": " << c.slices
+            << ", \"mark_ms\": " << c.mark_ms
+            << ", \"compact_ms\": " << c.compact_ms
+            << ", \"sweep_ms\": " << c.sweep_ms
+            << ", \"max_pause_ms\": " << c.max_pause_ms
+            << ", \"heap_bytes\": " << c.heap_bytes
+            << ", \"survival\": "
+            << (c.heap_bytes ? double(c.live.bytes) / c.heap_bytes : 1.0)
+            << ", \"live\": ";
+        write_totals(out, c.live);
+        out << ", \"freed\": ";
+        write_totals(out, c.freed);
+        out << "}";
+        sep = ",\n    ";
+    }
+    out << "\n  ]";
+
+    out << ",\n  \"live_by_kind\": {";
+    sep = "\n    ";
+    for (size_t k = 0; k <= Object::TypeMask; k++) {
+        if (stats.live_by_kind[k].objects == 0)
+            continue;
+        out << sep << "\"" << kind_name(k) << "\": ";
+        write_totals(out, stats.live_by_kind[k]);
+        sep = ",\n    ";
+    }
+    out << "\n  }";
+
+    out << ",\n  \"live_by_datatype\": [";
+    sep = "\n    ";
+    for (size_t id = 1; id < stats.live_by_datatype.size(); id++) {
+        auto& t = stats.live_by_datatype[id];
+        if (t.objects == 0)
+            continue;
+        out << sep << "{\"id\": " << id << ", \"fields\": [";
+        const char* field_sep = "";
+        for (auto field : Cell(Cell::datatypes[id]).fields()) {
+            out << field_sep;
+            write_string(out, field);
+            field_sep = ", ";
+        }
+        out << "], \"objects\": " << t.objects << ", \"bytes\": " << t.bytes << "}";
+        sep = ",\n    ";
+    }
+    out << "\n  ]";
+
+    out << ",\n  \"sample_interval\": " << stats.sample_interval;
+    out << ",\n  \"sites\": [";
+    sep = "\n    ";
+    for (auto& site : stats.sites) {
+        out << sep << "{\"program\": ";
+        write_string(out, site.first.first);
+        out << ", \"ip\": " << site.first.second
+            << ", \"samples\": " << site.second.samples
+            << ", \"bytes\": " << site.second.bytes << "}";
+        sep = ",\n    ";
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
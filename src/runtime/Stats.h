@@ -0,0 +1,69 @@
+#pragma once
+#include "Cell.h"
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+
+namespace run {
+
+/* what the collector has been doing; see GC::stats(). the counters
+   and census cost next to nothing and are always kept. allocation
+   sites are only sampled once GC::set_alloc_sampling() is given an
+   interval */
+struct GCStats
+{
+    GCStats ();
+
+    struct Totals
+    {
+        size_t objects = 0;
+        size_t bytes = 0;
+    };
+
+    // one collection, whether done all at once by GC::collect() or
+    // a slice at a time. times are in milliseconds
+    struct Collection
+    {
+        bool incremental = false;
+        size_t slices = 0;
+        double mark_ms = 0, compact_ms = 0, sweep_ms = 0;
+        // the longest the program was stopped for
+        double max_pause_ms = 0;
+        // the heap as it was when sweeping began, and what survived
+        size_t heap_bytes = 0;
+        Totals live, freed;
+    };
+
+    // since the collector was created
+    Totals allocated;
+    size_t collections;
+
+    // the most recent collections, oldest first
+    enum { HistoryMax = 64 };
+    std::deque<Collection> history;
+    // the most recent pauses, whole collections and slices alike, in
+    // milliseconds, oldest first
+    enum { PausesMax = 4096 };
+    std::deque<double> pauses;
+
+    // survivors of the last collection, by Object kind, and for
+    // instances by datatype id (see Cell::datatypes)
+    Totals live_by_kind[Object::TypeMask + 1];
+    std::vector<Totals> live_by_datatype;
+
+    // bytes allocated, by the program and instruction that were running
+    // when a sample was taken. each sample stands for a whole sampling
+    // interval's worth
+    struct Site
+    {
+        size_t samples = 0;
+        size_t bytes = 0;
+    };
+    size_t sample_interval;
+    std::map<std::pair<std::string, int>, Site> sites;
+};
+
+void write_json (std::ostream& out, const GCStats& stats);
+
+}
@@ -0,0 +1,27 @@
+#include "Symbol.h"
+
+namespace run {
+
+Symbol SymbolTable::intern (const std::string& name)
+{
+    auto map_iter = ids_.find(name);
+    if (map_iter != ids_.end())
+        return map_iter->second;
+
+    Symbol sym = Symbol(names_.size());
+    names_.push_back(name);
+    ids_[name] = sym;
+    return sym;
+}
+
+bool SymbolTable::find (const std::string& name, Symbol& sym_out) const
+{
+    auto map_iter = ids_.find(name);
+    if (map_iter == ids_.end())
+        return false;
+
+    sym_out = map_iter->second;
+    return true;
+}
+
+}
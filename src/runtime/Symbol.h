@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <unordered_map>
+
+namespace run {
+
+/* a symbol is a dense integer id for an interned name. the
+   environment uses symbols directly as indices into its global
+   and function tables, so resolving a name is only done once,
+   when code referring to it is built. */
+using Symbol = uint32_t;
+
+struct SymbolTable
+{
+    // returns the existing id for `name', or assigns the next one
+    Symbol intern (const std::string& name);
+
+    // looks up `name' without interning it
+    bool find (const std::string& name, Symbol& sym_out) const;
+
+    inline const std::string& name (Symbol sym) const
+    { return names_[sym]; }
+
+    inline size_t size () const
+    { return names_.size(); }
+
+private:
+    std::unordered_map<std::string, Symbol> ids_;
+    std::vector<std::string> names_;
+};
+
+}
@@ -125,6 +125,12 @@ void IntExpr::write (std::ostream& os)
     os << val;
 }
 
+BigIntExpr::~BigIntExpr () {}
+void BigIntExpr::write (std::ostream& os)
+{
+    os << digits;
+}
+
 StringExpr::~StringExpr () {}
 void StringExpr::write (std::ostream& os)
 {
@@ -12,7 +12,7 @@ namespace ast
 /*
 Defn ::=
   Global(x, expr)
-  Function(fn_name, args, body)
+  Function(fn_name, args, arg_types, body)
 
 Stmt ::=
   Let(x, expr)
@@ -24,6 +24,7 @@ Stmt ::=
 
 Expr ::=
   IntLiteral(n)
+  BigIntLiteral(digits)
   StringLiteral(s)
   Var(x)
   App(fn_name, args)
@@ -73,20 +74,25 @@ struct GlobalDefn : public Defn
     ExprPtr init_expr;
 };
 
-/* fn f (x, ..) ... end */
+/* fn f (x, y is t, ..) ... end */
 struct FunctionDefn : public Defn
 {
     inline FunctionDefn (Span span, FnName fn,
                          std::vector<VarName> args,
+                         std::vector<VarName> types,
                          BodyStmts b)
         : Defn(std::move(span))
         , name(std::move(fn))
         , arg_names(std::move(args))
+        , arg_types(std::move(types))
         , body(std::move(b))
     {}
     virtual ~FunctionDefn ();
     FnName name;
     std::vector<VarName> arg_names;
+    // name of the global holding each argument's datatype,
+    // or "" for arguments of any type
+    std::vector<VarName> arg_types;
     BodyStmts body;
 };
 
@@ -225,6 +231,19 @@ struct IntExpr : public Expr
     Fixnum val;
 };
 
+/* 123456789012345678901234567890 */
+struct BigIntExpr : public Expr
+{
+    inline BigIntExpr (Span span, std::string ds)
+        : Expr(std::move(span))
+        , digits(std::move(ds))
+    {}
+    virtual ~BigIntExpr ();
+    virtual void write (std::ostream& os);
+    // decimal, too large for a fixnum
+    std::string digits;
+};
+
 /* "abcdef" */
 struct StringExpr : public Expr
 {
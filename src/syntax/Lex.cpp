@@ -155,19 +155,28 @@ Token Lex::read_ident_ ()
 Token Lex::read_number_ ()
 {
     Span span(src);
-    const auto num_str = src->take_while(runes::is_identifier, span);
+    auto num_str = src->take_while(runes::is_identifier, span);
 
     Fixnum fx = 0;
+    bool big = false;
     for (size_t i = 0; i < num_str.size(); i++) {
         const auto chr = num_str[i];
         if ('0' <= chr && chr <= '9') {
-            fx = (fx * 10) + (chr - '0');
+            const Fixnum digit = chr - '0';
+            if (fx > (FixnumMax - digit) / 10)
+                big = true;
+            else
+                fx = (fx * 10) + digit;
         }
         else {
             throw span_error(std::move(span), "invalid character in integer");
         }
     }
 
+    // too large for a fixnum; keep the digits for a bignum
+    if (big)
+        return Token(Token::BigInt, span, std::move(num_str));
+
     return Token(Token::Int, span, fx);
 }
 
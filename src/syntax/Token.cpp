@@ -19,6 +19,7 @@ void Token::write (std::ostream& os, Kind kind)
     case EndOfFile: os << "<eof>"; break;
     case Ident:  os << "<ident>"; break;
     case Int:    os << "<integer>"; break;
+    case BigInt: os << "<integer>"; break;
     case String: os << "<string>"; break;
     case Eq:     os << "`=='"; break;
     case NotEq:  os << "`/='"; break;
@@ -12,7 +12,7 @@ struct Token
 
         /* special */
         EndOfFile = 0x10000,
-        Int, String,
+        Int, BigInt, String,
         Ident,
         Eq, // ==
         NotEq, // /=
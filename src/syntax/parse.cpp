@@ -27,12 +27,14 @@ DefnPtr parse_defn (Lex& lx)
     if (lx.at(0) == T::KW_fn) {
         lx.take1();
         auto fn_name = parse_fn_name(lx);
-        auto arg_names = parse_arg_names(lx);
+        std::vector<VarName> arg_types;
+        auto arg_names = parse_arg_names(lx, arg_types);
         auto stmts = parse_stmts(lx);
         lx.eat(T::KW_end);
         return DefnPtr(new FunctionDefn
             (std::move(span), std::move(fn_name),
-             std::move(arg_names), std::move(stmts)));
+             std::move(arg_names), std::move(arg_types),
+             std::move(stmts)));
     }
 
     // global definition:
@@ -215,6 +217,8 @@ ExprPtr parse_factor_base (Lex& lx)
         // <literals>
     case T::Int:
         return ExprPtr(new IntExpr(span, lx.take1().int_val));
+    case T::BigInt:
+        return ExprPtr(new BigIntExpr(span, lx.take1().string_val));
     case T::String:
         return ExprPtr(new StringExpr(span, lx.take1().string_val));
 
@@ -325,15 +329,33 @@ KeyName parse_key (Lex& lx)
     return lx.eat(T::Ident).string_val;
 }
 
-std::vector<VarName> parse_arg_names (Lex& lx)
+namespace {
+// <var>
+// <var> is <type>
+void parse_arg_name (Lex& lx,
+                     std::vector<VarName>& names,
+                     std::vector<VarName>& types)
+{
+    names.push_back(lx.eat(T::Ident).string_val);
+    if (lx.at(0) == T::KW_is) {
+        lx.take1();
+        types.push_back(lx.eat(T::Ident).string_val);
+    }
+    else {
+        types.push_back("");
+    }
+}
+}
+
+std::vector<VarName> parse_arg_names (Lex& lx, std::vector<VarName>& types)
 {
     std::vector<VarName> names;
     lx.eat(T::Kind('('));
     if (lx.at(0) != ')') {
-        names.push_back(lx.eat(T::Ident).string_val);
+        parse_arg_name(lx, names, types);
         while (lx.at(0) == ',') {
             lx.take1();
-            names.push_back(lx.eat(T::Ident).string_val);
+            parse_arg_name(lx, names, types);
         }
     }
     lx.eat(T::Kind(')'));
@@ -27,7 +27,8 @@ ast::BodyStmts parse_else (lex::Lex& lexer);
 
 // etc.
 ast::KeyName parse_key (lex::Lex& lexer);
-std::vector<ast::VarName> parse_arg_names (lex::Lex& lexer);
+std::vector<ast::VarName> parse_arg_names (lex::Lex& lexer,
+                                           std::vector<ast::VarName>& types_out);
 std::vector<ast::ExprPtr> parse_args (lex::Lex& lexer);
 
 }